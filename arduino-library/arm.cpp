@@ -64,6 +64,8 @@ char    ZXY_EULER[10] = "zxy Euler";
 */
 void arm_init(arm_rec *arm)
 {
+  int i;
+
   /* Temporarily use default port & baud rate
        We're not connecting yet; so these params
        will not nec. be used for communication. */
@@ -75,8 +77,20 @@ void arm_init(arm_rec *arm)
 
   arm->timer_report = 0;
   arm->anlg_reports = 0;
+  arm->use_cache = 0;
+  arm->trig_tables = NULL;
+  arm->num_trig_tables = 0;
+  for (i = 0; i < NUM_DOF; i++)
+    arm->joint_trig[i] = NULL;
+
+  /* T's bottom row is constant {0,0,0,1}; the calculations leave it be */
+  arm_identity_4x4(arm->T);
+  arm_recalc_all(arm);
+
   arm->num_points = -1;
   arm->packet_calc_fn = arm_calc_nothing;
+  arm->stream_depth = 0;
+  arm->stream_encoders = 6;
 
   arm->BETA = 0.0;
 }
@@ -109,6 +123,33 @@ arm_result arm_connect(arm_rec *arm, int port, long int baud)
 }
 
 
+/* arm_connect_fastest() signs on at SAFE_BAUD, then moves the link up to
+     the fastest standard rate (at most max_baud) that passes a burst of
+     test packets, and only then reads the Arm's constants.
+     The rate in use ends up in arm->hci.baud_rate.
+*/
+arm_result arm_connect_fastest(arm_rec *arm, int port, long int max_baud)
+{
+  arm_result result = TRY_AGAIN;
+  long int baud = SAFE_BAUD;
+
+  while (result == TRY_AGAIN)
+  {
+    hci_com_params(&arm->hci, port, baud);
+    hci_clear_packet(&arm->hci);
+    result = hci_connect(&arm->hci);
+    port = arm->hci.port_num;
+    baud = arm->hci.baud_rate;
+  }
+
+  if (result == SUCCESS)
+    result = hci_upgrade_baud(&arm->hci, max_baud, UPGRADE_BURST);
+  if (result == SUCCESS) result = arm_get_constants(arm);
+
+  return result;
+}
+
+
 /* arm_disconnect() ends the current session and leaves hardware in a mode
       waiting for the autosynch process.  The Arm can be accessed again
       without manual reset by running arm_connect().
@@ -332,6 +373,7 @@ void AutoPlotPointUndo(arm_rec* arm, float newX, float newY, float newZ) {
 void BallTip(arm_rec *arm) {
   float len_factor = (arm->len_units == INCHES ? 1.0 : 25.4 );
   arm->D[5] = arm->D5Point + 0.242 * len_factor;
+  arm_calc_params(arm);
 }
 
 /* PointTip(arm_rec *arm)
@@ -339,6 +381,7 @@ void BallTip(arm_rec *arm) {
 */
 void PointTip(arm_rec *arm) {
   arm->D[5] = arm->D5Point;
+  arm_calc_params(arm);
 }
 
 /* CustomTip(arm_rec *arm, float delta)
@@ -346,6 +389,7 @@ void PointTip(arm_rec *arm) {
 */
 void CustomTip(arm_rec *arm, float delta) {
   arm->D[5] = arm->D5Point + delta;
+  arm_calc_params(arm);
 }
 
 
@@ -559,6 +603,27 @@ arm_result arm_check_motion(arm_rec *arm)
 }
 
 
+/* arm_read_motion() takes every packet the HCI has sent in motion-
+     reporting mode since the last call, up to max, into samples[]
+     (oldest first).  Joint angles and stylus are worked out from the
+     newest one only, so a late caller catches up at once instead of
+     working through a backlog of stale positions.
+     Returns the # of samples; zero if nothing new has come in.
+*/
+int arm_read_motion(arm_rec *arm, hci_sample *samples, int max)
+{
+  int n;
+
+  if ( (n = hci_read_motion(&arm->hci, samples, max)) > 0)
+  {
+    arm_calc_joints(arm);
+    (*(arm->packet_calc_fn))(arm);
+  }
+
+  return n;
+}
+
+
 /* arm_stylus_6DOF_motion() puts the Arm in motion-reporting mode.
      All joint angles will be reported if Arm state changes sufficiently.
      Packets will be separated by at least packet_delay milliseconds.
@@ -638,6 +703,109 @@ void arm_end_motion(arm_rec *arm)
 }
 
 
+/*--------------------------------------*/
+/* Getting data with 'streaming' method */
+/*--------------------------------------*/
+/* These commands keep 'depth' requests queued ahead at the HCI, so the
+     next packet is already on the wire while the host handles this one.
+     Call arm_check_stream() to wait for each packet; it issues the next
+     request as soon as a packet is parsed.  A depth of 2 is enough to
+     keep the link busy.  Call arm_end_stream() before using any other
+     method.
+*/
+
+
+/* arm_check_stream() waits for the next packet of a stream, parses it,
+     requests one more and calculates appropriate arm_rec fields.
+     After an error the link is reset and the stream restarted.
+*/
+arm_result arm_check_stream(arm_rec *arm)
+{
+  arm_result result;
+
+  if ( (result = hci_wait_packet(&arm->hci)) == SUCCESS)
+  {
+    /* Keep the pipeline full before doing any calculation */
+    while (arm->hci.packets_expected < arm->stream_depth)
+      hci_std_cmd(&arm->hci, arm->timer_report, arm->anlg_reports,
+                  arm->stream_encoders);
+    arm_calc_joints(arm);
+    (*(arm->packet_calc_fn))(arm);
+  }
+  else if (arm->stream_depth)
+  {
+    /* Packet boundaries are lost; start over with a clean link */
+    hci_reset_com(&arm->hci);
+    arm_start_stream(arm, arm->stream_encoders, arm->stream_depth);
+  }
+
+  return result;
+}
+
+
+/* arm_stylus_6DOF_stream() starts streaming stylus position and direction.
+*/
+void arm_stylus_6DOF_stream(arm_rec *arm, int depth)
+{
+  arm_start_stream(arm, 6, depth);
+  arm->packet_calc_fn = arm_calc_stylus_6DOF;
+}
+
+
+/* arm_stylus_3DOF_stream() starts streaming stylus position.
+*/
+void arm_stylus_3DOF_stream(arm_rec *arm, int depth)
+{
+  arm_start_stream(arm, 6, depth);
+  arm->packet_calc_fn = arm_calc_stylus_3DOF;
+}
+
+
+/* arm_3joint_stream() starts streaming the first three joint angles
+*/
+void arm_3joint_stream(arm_rec *arm, int depth)
+{
+  arm_start_stream(arm, 3, depth);
+  arm->packet_calc_fn = arm_calc_nothing;
+}
+
+
+/* arm_6joint_stream() starts streaming all six joint angles
+*/
+void arm_6joint_stream(arm_rec *arm, int depth)
+{
+  arm_start_stream(arm, 6, depth);
+  arm->packet_calc_fn = arm_calc_nothing;
+}
+
+
+/* arm_full_stream() starts streaming all quantities in the arm_rec,
+     subject to the timer_report and anlg_reports flags
+*/
+void arm_full_stream(arm_rec *arm, int depth)
+{
+  arm_start_stream(arm, 6, depth);
+  arm->packet_calc_fn = arm_calc_full;
+}
+
+
+/* arm_end_stream() stops requesting packets and collects the ones
+     still on their way, so the link is clean for other methods.
+*/
+void arm_end_stream(arm_rec *arm)
+{
+  arm->stream_depth = 0;
+  while (arm->hci.packets_expected > 0)
+  {
+    if (hci_wait_packet(&arm->hci) != SUCCESS)
+    {
+      hci_reset_com(&arm->hci);
+      break;
+    }
+  }
+}
+
+
 
 
 /*-----------------------------------------------*/
@@ -707,6 +875,55 @@ void arm_skip_analog(arm_rec *arm)
 }
 
 
+/* arm_use_cache() makes arm_connect() take the Arm's constants from the
+     calibration cache when it holds this Arm, and save them there when it
+     does not.  Only the serial number and version are then asked for.
+*/
+void arm_use_cache(arm_rec *arm)
+{
+  arm->use_cache = 1;
+}
+
+
+/* arm_skip_cache() makes arm_connect() download all the Arm's constants.
+*/
+void arm_skip_cache(arm_rec *arm)
+{
+  arm->use_cache = 0;
+}
+
+
+/* arm_use_trig_tables() makes arm_connect() set up tables that give the
+     sine and cosine of each joint angle straight from its encoder count,
+     so the calculations make no calls to sin() or cos().  Worth it where
+     these are slow, e.g. on an AVR without floating-point hardware.
+     The caller provides room for num_tables tables, one per encoder
+     resolution; joints of any further resolution keep using sin() & cos().
+     The room must start zeroed, as a global or static array does, and may
+     be shared by several arm_recs.  A table takes about 780 bytes on an AVR.
+*/
+void arm_use_trig_tables(arm_rec *arm, trig_table *tables, int num_tables)
+{
+  arm->trig_tables = tables;
+  arm->num_trig_tables = num_tables;
+}
+
+
+/* arm_skip_trig_tables() goes back to calling sin() and cos() for the
+     joint angles, from now on.
+*/
+void arm_skip_trig_tables(arm_rec *arm)
+{
+  int i;
+
+  arm->trig_tables = NULL;
+  arm->num_trig_tables = 0;
+  for (i = 0; i < NUM_DOF; i++)
+    arm->joint_trig[i] = NULL;
+  arm_recalc_all(arm);
+}
+
+
 
 
 /*-------------------------*/
@@ -730,7 +947,6 @@ void arm_skip_analog(arm_rec *arm)
 void arm_calc_stylus_6DOF(arm_rec *arm)
 {
   arm_calc_trig(arm);
-  arm_calc_M(arm);
   arm_calc_T(arm);
 
   arm->stylus_tip.x = arm->T[0][3];
@@ -746,7 +962,6 @@ void arm_calc_stylus_6DOF(arm_rec *arm)
 void arm_calc_stylus_3DOF(arm_rec *arm)
 {
   arm_calc_trig(arm);
-  arm_calc_M(arm);
   arm_calc_T(arm);
 
   arm->stylus_tip.x = arm->T[0][3];
@@ -755,29 +970,57 @@ void arm_calc_stylus_3DOF(arm_rec *arm)
 }
 
 
+/* table_trig() looks up the sine and cosine of an encoder count.
+*/
+static void table_trig(trig_table *t, unsigned count, ratio *sn, ratio *cs)
+{
+  unsigned rest = count & ((1u << t->quarter_bits) - 1);
+  int     h = rest >> t->fine_bits;
+  int     l = rest & ((1u << t->fine_bits) - 1);
+  ratio   sh = t->coarse_sn[h], ch = t->coarse_sn[t->num_coarse - h];
+  ratio   s = sh * t->fine_cs[l] + ch * t->fine_sn[l];
+  ratio   c = ch * t->fine_cs[l] - sh * t->fine_sn[l];
+
+  switch ((count >> t->quarter_bits) & 3)
+  {
+    case 0: *sn = s;  *cs = c;  break;
+    case 1: *sn = c;  *cs = -s; break;
+    case 2: *sn = -s; *cs = -c; break;
+    case 3: *sn = -c; *cs = s;  break;
+  }
+}
+
+
 /* arm_calc_trig() pre-calculates sines and cosines of the joint angles
       Calculates either 3 or 6 joints' worth, depending on encoders reported
         in previous frame.
+      Joints whose encoder count has not changed keep their cs & sn; the
+        first that has is noted in first_moved for arm_calc_T().
+      Joints with a trig table look them up by encoder count.
 */
 void arm_calc_trig(arm_rec *arm)
 {
-  angle   *jnt = arm->joint_rad;
-  ratio   *sn = arm->sn, *cs = arm->cs;
+  int     i, n = (arm->hci.encoder_updated[5] ? NUM_DOF : 3);
+  int     count;
 
-  *sn++ = sin(*jnt);
-  *cs++ = cos(*jnt++);
-  *sn++ = sin(*jnt);
-  *cs++ = cos(*jnt++);
-  *sn++ = sin(*jnt);
-  *cs++ = cos(*jnt++);
-  if (arm->hci.encoder_updated[5])
+  for (i = 0; i < n; i++)
   {
-    *sn++ = sin(*jnt);
-    *cs++ = cos(*jnt++);
-    *sn++ = sin(*jnt);
-    *cs++ = cos(*jnt++);
-    *sn++ = sin(*jnt);
-    *cs++ = cos(*jnt++);
+    count = arm->hci.encoder[i] & arm->hci.max_encoder[i];
+    if (count == arm->trig_count[i])
+      continue;
+    arm->trig_count[i] = count;
+    if (i < arm->first_moved)
+      arm->first_moved = i;
+
+    if (arm->joint_trig[i] != NULL)
+    {
+      table_trig(arm->joint_trig[i], count, &arm->sn[i], &arm->cs[i]);
+    }
+    else
+    {
+      arm->sn[i] = sin(arm->joint_rad[i]);
+      arm->cs[i] = cos(arm->joint_rad[i]);
+    }
   }
 }
 
@@ -899,69 +1142,164 @@ void arm_assign_4x4(matrix_4 to, matrix_4 from)
 }
 
 
+/* arm_expand_3x4() copies an affine 3-by-4 matrix into a 4-by-4 one,
+     adding the bottom row {0,0,0,1}, e.g. to use M[] with arm_mul_4x4().
+*/
+void arm_expand_3x4(matrix_4 to, affine_3x4 from)
+{
+  to[0][0] = from[0][0], to[0][1] = from[0][1], to[0][2] = from[0][2];
+  to[0][3] = from[0][3];
+  to[1][0] = from[1][0], to[1][1] = from[1][1], to[1][2] = from[1][2];
+  to[1][3] = from[1][3];
+  to[2][0] = from[2][0], to[2][1] = from[2][1], to[2][2] = from[2][2];
+  to[2][3] = from[2][3];
+  to[3][0] = to[3][1] = to[3][2] = 0.0;
+  to[3][3] = 1.0;
+}
+
+
+/* arm_assign_3x4() copies an affine 3-by-4 matrix.
+*/
+void arm_assign_3x4(affine_3x4 to, affine_3x4 from)
+{
+  to[0][0] = from[0][0], to[0][1] = from[0][1], to[0][2] = from[0][2];
+  to[0][3] = from[0][3];
+  to[1][0] = from[1][0], to[1][1] = from[1][1], to[1][2] = from[1][2];
+  to[1][3] = from[1][3];
+  to[2][0] = from[2][0], to[2][1] = from[2][1], to[2][2] = from[2][2];
+  to[2][3] = from[2][3];
+}
+
+
 /* arm_calc_T() calculates the  NUM_DOF-matrix chain, resulting in matrix T.
      Stores intermediate endpoints along the way.
+     Rather than multiplying out the M[] matrices, it applies each joint's
+     skew by ALPHA (and on joint 2 by BETA), its rotation about z and its
+     offsets to the rows of the frame so far, leaving out the zeros and
+     ones of the DH matrices.
+     Starts over from the frame[] before the first joint arm_calc_trig()
+     found moved, so the joints nearer the base that have not moved cost
+     nothing.  Does nothing if none moved.
 */
 void arm_calc_T(arm_rec *arm)
 {
-  int i;
-  matrix_4 temp;
-
-  i = 0;
-  arm_assign_4x4(temp, arm->M[0]);
-  arm->endpoint[i].x = temp[0][3];
-  arm->endpoint[i].y = temp[1][3];
-  arm->endpoint[i].z = temp[2][3];
-  for (i = 1; i < NUM_DOF; i++)
+  int     i, j;
+  ratio   c, s, ca, sa;
+  ratio   x, y, z, g0, g1, g2;
+  length  a, d;
+  affine_3x4 R;       /* top rows of T; kept local so the compiler
+                         need not reload arm fields after each store */
+  ratio   (*F)[3] = arm->skew;
+
+  i = arm->first_moved;
+  if (i >= NUM_DOF)
+    return;
+  if (i > 0)
+    arm_assign_3x4(R, arm->frame[i - 1]);
+  else
   {
-    arm_mul_4x4(temp, arm->M[i], arm->T);
-    arm_assign_4x4(temp, arm->T);
-    arm->endpoint[i].x = temp[0][3];
-    arm->endpoint[i].y = temp[1][3];
-    arm->endpoint[i].z = temp[2][3];
+    /* Joint 0: T is M[0], and joint 0 is never skewed about y */
+    c = arm->cs[0], s = arm->sn[0];
+    ca = arm->csALPHA[0], sa = arm->snALPHA[0];
+    R[0][0] = c, R[0][1] = -s;
+    R[0][2] = 0.0, R[0][3] = arm->A[0];
+    R[1][0] = s * ca, R[1][1] = c * ca;
+    R[1][2] = -sa, R[1][3] = -sa * arm->D[0];
+    R[2][0] = s * sa, R[2][1] = c * sa;
+    R[2][2] = ca, R[2][3] = ca * arm->D[0];
+    arm->endpoint[0].x = R[0][3];
+    arm->endpoint[0].y = R[1][3];
+    arm->endpoint[0].z = R[2][3];
+    arm_assign_3x4(arm->frame[0], R);
+    i = 1;
   }
+
+  for (; i < NUM_DOF; i++)
+  {
+    c = arm->cs[i], s = arm->sn[i];
+    ca = arm->csALPHA[i], sa = arm->snALPHA[i];
+    a = arm->A[i], d = arm->D[i];
+    for (j = 0; j < 3; j++)
+    {
+      x = R[j][0], y = R[j][1], z = R[j][2];
+      if (i == 2) {
+        g0 = x * F[0][0] + y * F[1][0] + z * F[2][0];
+        g1 = y * F[1][1] + z * F[2][1];
+        g2 = x * F[0][2] + y * F[1][2] + z * F[2][2];
+      } else {
+        g0 = x;
+        g1 = y * ca + z * sa;
+        g2 = z * ca - y * sa;
+      }
+      R[j][0] = c * g0 + s * g1;
+      R[j][1] = c * g1 - s * g0;
+      R[j][2] = g2;
+      R[j][3] += a * x + d * g2;
+    }
+    arm->endpoint[i].x = R[0][3];
+    arm->endpoint[i].y = R[1][3];
+    arm->endpoint[i].z = R[2][3];
+    if (i < NUM_DOF - 1)
+      arm_assign_3x4(arm->frame[i], R);
+  }
+
+  /* The bottom row stays as arm_init() set it */
+  for (j = 0; j < 3; j++)
+  {
+    arm->T[j][0] = R[j][0], arm->T[j][1] = R[j][1];
+    arm->T[j][2] = R[j][2], arm->T[j][3] = R[j][3];
+  }
+  arm->first_moved = NUM_DOF;
 }
 
 
-/* arm_calc_M() calculates all the M[] matrices */
+/* arm_calc_M() calculates all the M[] matrices
+     arm_calc_T() no longer needs them, so they are only computed here;
+     call this to inspect the links.
+*/
 void arm_calc_M(arm_rec *arm)
 {
-  int i;
+  int i, j;
   ratio   c, s;
-  ratio   ca, sa;
-  matrix_4 *M;
+  ratio   F[3][3];
 
   for (i = 0; i < NUM_DOF; i++)
   {
     c = arm->cs[i], s = arm->sn[i];
-    ca = arm->csALPHA[i], sa = arm->snALPHA[i];
-    M = &arm->M[i];
-    if (i != 2) {
-      (*M)[0][0] = c, (*M)[0][1] = -s;
-      (*M)[0][2] = 0.0, (*M)[0][3] = arm->A[i];
-      (*M)[1][0] = s * ca, (*M)[1][1] = c * ca;
-      (*M)[1][2] = -sa, (*M)[1][3] = -sa * arm->D[i];
-      (*M)[2][0] = s * sa, (*M)[2][1] = c * sa;
-      (*M)[2][2] = ca, (*M)[2][3] = ca * arm->D[i];
-      (*M)[3][0] = (*M)[3][1] = (*M)[3][2] = 0.0;
-      (*M)[3][3] = 1.0;
-    } else {
-      ratio cb, sb;
-      cb = cos(arm->BETA);            sb = sin(arm->BETA);
-
-      (*M)[0][0] = c * cb,                      (*M)[0][1] = -s * cb;
-      (*M)[0][2] = sb,                                (*M)[0][3] = sb * arm->D[i] + arm->A[i];
-      (*M)[1][0] = s * ca + sa * sb * c, (*M)[1][1] = c * ca - sa * sb * s;
-      (*M)[1][2] = -sa * cb,                    (*M)[1][3] = -sa * cb * arm->D[i];
-      (*M)[2][0] = s * sa - ca * sb * c,      (*M)[2][1] = c * sa + s * sb * ca;
-      (*M)[2][2] = ca * cb,                     (*M)[2][3] = cb * ca * arm->D[i];
-      (*M)[3][0] = (*M)[3][1] = (*M)[3][2] = 0.0;
-      (*M)[3][3] = 1.0;
+    if (i == 2)
+      memcpy(F, arm->skew, sizeof(F));
+    else
+    {
+      F[0][0] = 1.0, F[0][1] = 0.0, F[0][2] = 0.0;
+      F[1][0] = 0.0, F[1][1] = arm->csALPHA[i], F[1][2] = -arm->snALPHA[i];
+      F[2][0] = 0.0, F[2][1] = arm->snALPHA[i], F[2][2] = arm->csALPHA[i];
     }
+    for (j = 0; j < 3; j++)
+    {
+      arm->M[i][j][0] = c * F[j][0] + s * F[j][1];
+      arm->M[i][j][1] = c * F[j][1] - s * F[j][0];
+      arm->M[i][j][2] = F[j][2];
+      arm->M[i][j][3] = F[j][2] * arm->D[i];
+    }
+    arm->M[i][0][3] += arm->A[i];
   }
 }
 
 
+/* arm_recalc_all() makes the next calculation redo every joint's cs & sn
+     and frame, rather than only those of the joints that moved.  Needed
+     whenever anything but the encoder counts changes what they would be.
+*/
+void arm_recalc_all(arm_rec *arm)
+{
+  int i;
+
+  for (i = 0; i < NUM_DOF; i++)
+    arm->trig_count[i] = -1;
+  arm->first_moved = 0;
+}
+
+
 /* arm_calc_stylus_dir() calculates the direction of the stylus from matrix T.
 */
 void arm_calc_stylus_dir(arm_rec *arm)
@@ -1068,6 +1406,7 @@ arm_result arm_convert_ext_params(arm_rec *arm)
   if (strstr(arm->hci.comment, "Beta") != NULL && arm->ext_p_block_size >= 2) {
     temp = ((signed char) pb[0]) * 256 + pb[1];
     arm->BETA = (temp / 32768.0) * PI;
+    arm_calc_params(arm);
   }
 
   return SUCCESS;
@@ -1158,16 +1497,79 @@ int arm_params_DH0_5(arm_rec *arm)
 
 /* arm_calc_params() calculates arm_rec constants that are found from
      the params in the downloaded block.
+     Also builds joint 2's skew[], so call it again whenever
+     A[], D[], ALPHA[] or BETA change.
 */
 void arm_calc_params(arm_rec *arm)
 {
   int  i;
+  ratio ca, sa, cb, sb;
 
   for (i = 0; i < NUM_DOF; i++)
   {
     arm->csALPHA[i] = cos(arm->ALPHA[i]);
     arm->snALPHA[i] = sin(arm->ALPHA[i]);
   }
+
+  ca = arm->csALPHA[2], sa = arm->snALPHA[2];
+  cb = cos(arm->BETA), sb = sin(arm->BETA);
+  arm->skew[0][0] = cb,       arm->skew[0][1] = 0.0, arm->skew[0][2] = sb;
+  arm->skew[1][0] = sa * sb,  arm->skew[1][1] = ca,  arm->skew[1][2] = -sa * cb;
+  arm->skew[2][0] = -ca * sb, arm->skew[2][1] = sa,  arm->skew[2][2] = ca * cb;
+  arm_recalc_all(arm);
+}
+
+
+/* arm_calc_trig_tables() points each joint at the trig table for its
+     encoder resolution, building the table if no joint had it yet.
+     A joint keeps using sin() & cos() if its resolution is not a power
+     of two, is finer than the tables allow, or all tables are taken.
+*/
+void arm_calc_trig_tables(arm_rec *arm)
+{
+  trig_table *t;
+  unsigned counts;
+  int     i, j, bits;
+  double  step;
+
+  for (i = 0; i < NUM_DOF; i++)
+  {
+    arm->joint_trig[i] = NULL;
+    counts = arm->hci.max_encoder[i] + 1;
+    for (bits = 0; (1u << bits) < counts; bits++)
+      ;
+    if ((1u << bits) != counts || bits < 2
+      || bits - 2 > TRIG_COARSE_BITS + TRIG_FINE_BITS)
+      continue;
+
+    for (j = 0; j < arm->num_trig_tables; j++)
+      if (arm->trig_tables[j].counts == counts
+        || arm->trig_tables[j].counts == 0)
+        break;
+    if (j == arm->num_trig_tables) continue;
+    t = &arm->trig_tables[j];
+
+    if (t->counts == 0)
+    {
+      t->quarter_bits = bits - 2;
+      t->fine_bits = t->quarter_bits / 2;
+      if (t->quarter_bits - t->fine_bits > TRIG_COARSE_BITS)
+        t->fine_bits = t->quarter_bits - TRIG_COARSE_BITS;
+      t->num_coarse = 1 << (t->quarter_bits - t->fine_bits);
+
+      step = 2.0 * PI / counts;
+      for (j = 0; j <= t->num_coarse; j++)
+        t->coarse_sn[j] = sin(step * (j << t->fine_bits));
+      for (j = 0; j < (1 << t->fine_bits); j++)
+      {
+        t->fine_sn[j] = sin(step * j);
+        t->fine_cs[j] = cos(step * j);
+      }
+      t->counts = counts;
+    }
+    arm->joint_trig[i] = t;
+  }
+  arm_recalc_all(arm);
 }
 
 
@@ -1184,12 +1586,12 @@ void arm_calc_params(arm_rec *arm)
 */
 void arm_install_simple(arm_rec *arm)
 {
-  arm->hci.TIMED_OUT_handler = simple_TIMED_OUT;
-  arm->hci.BAD_PORT_handler = simple_BAD_PORT;
-  arm->hci.BAD_PACKET_handler = simple_BAD_PACKET;
-  arm->hci.NO_HCI_handler = simple_NO_HCI;
-  arm->hci.CANT_BEGIN_handler = simple_CANT_BEGIN;
-  arm->hci.CANT_OPEN_handler = simple_CANT_OPEN_PORT;
+  arm->hci.handler[TIMED_OUT] = simple_TIMED_OUT;
+  arm->hci.handler[BAD_PORT_NUM] = simple_BAD_PORT;
+  arm->hci.handler[BAD_PACKET] = simple_BAD_PACKET;
+  arm->hci.handler[NO_HCI] = simple_NO_HCI;
+  arm->hci.handler[CANT_BEGIN] = simple_CANT_BEGIN;
+  arm->hci.handler[CANT_OPEN_PORT] = simple_CANT_OPEN_PORT;
 }
 
 
@@ -1197,7 +1599,7 @@ void arm_install_simple(arm_rec *arm)
 */
 arm_result simple_TIMED_OUT(hci_rec *hci, arm_result condition)
 {
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
 
   /* Empty the host buffer so we can try again */
@@ -1213,7 +1615,7 @@ arm_result simple_BAD_PORT(hci_rec *hci, arm_result condition)
 {
   char    ch[5];
 
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
   printf("   Type 'p' to try a different PORT,\n");
   printf("   Type any other key to ABORT.\n");
@@ -1235,7 +1637,7 @@ arm_result simple_BAD_PACKET(hci_rec *hci, arm_result condition)
 {
   char    ch[5];
 
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
   printf("   Type 'f' to FLUSH host serial buffer.\n");
   printf("   Type any other key to ABORT.\n");
@@ -1261,7 +1663,7 @@ arm_result simple_NO_HCI(hci_rec *hci, arm_result condition)
   char    ch[5];
   arm_result result;
 
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
   printf("Check that the electronics module is plugged in and turned on.\n");
   printf("   Type 'c' to change baud rate or port number and RETRY,\n");
@@ -1300,7 +1702,7 @@ arm_result simple_CANT_BEGIN(hci_rec *hci, arm_result condition)
   char ch[5];
   arm_result result;
 
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
   printf("You must reset the electronics module and check all connections.\n");
   printf("   Type 'a' to ABORT,\n");
@@ -1332,7 +1734,7 @@ arm_result simple_CANT_OPEN_PORT(hci_rec *hci, arm_result condition)
   char ch[5];
   arm_result result;
 
-  printf("\n%s: port %d, %ld baud\n", condition,
+  printf("\n%s: port %d, %ld baud\n", hci_result_string(condition),
          hci->port_num, hci->baud_rate);
   printf("Check communications parameters and host hardware.\n");
   printf("   Type 'c' to change baud rate or port number and RETRY,\n");
@@ -1389,30 +1791,129 @@ void arm_start_motion(arm_rec *arm, int num_encoders, int motion_thresh,
 }
 
 
+/* arm_start_stream() sends the first 'depth' requests of a stream.
+     Do not call this function directly.
+*/
+void arm_start_stream(arm_rec *arm, int num_encoders, int depth)
+{
+  if (depth < 1) depth = 1;
+  if (depth > MAX_STREAM_DEPTH) depth = MAX_STREAM_DEPTH;
+  arm->stream_encoders = num_encoders;
+  arm->stream_depth = depth;
+  while (arm->hci.packets_expected < depth)
+    hci_std_cmd(&arm->hci, arm->timer_report, arm->anlg_reports,
+                num_encoders);
+}
+
+
+/* arm_load_cache() restores the constants saved for the connected Arm
+     by arm_save_cache(), asking the Arm only for its serial number and
+     firmware version.  Returns False (zero) if there is no saved record
+     for this serial number and version; the Arm fields are then unchanged
+     apart from those two strings.
+*/
+int arm_load_cache(arm_rec *arm)
+{
+  arm_cache_rec cache;
+  hci_rec *hci = &arm->hci;
+  int i;
+
+  if (hci_string_cmd(hci, GET_SERNUM) != SUCCESS) return 0;
+  if (hci_string_cmd(hci, GET_VERSION) != SUCCESS) return 0;
+  if (!host_load_cache(hci->serial_number, &cache, sizeof(cache)))
+    return 0;
+  if (cache.size != (int) sizeof(cache)
+      || !hci_strcmp(cache.serial_number, hci->serial_number)
+      || !hci_strcmp(cache.version, hci->version)
+      || cache.p_block_size > PARAM_BLOCK_SIZE
+      || cache.ext_p_block_size > EXT_PARAM_BLOCK_SIZE)
+    return 0;
+
+  hci_strcopy(cache.product_name, hci->product_name);
+  hci_strcopy(cache.product_id, hci->product_id);
+  hci_strcopy(cache.model_name, hci->model_name);
+  hci_strcopy(cache.comment, hci->comment);
+  hci_strcopy(cache.param_format, hci->param_format);
+  for (i = 0; i < NUM_BUTTONS; i++)
+    hci->button_supported[i] = cache.button_supported[i];
+  hci->max_timer = cache.max_timer;
+  for (i = 0; i < NUM_ANALOGS; i++)
+    hci->max_analog[i] = cache.max_analog[i];
+  for (i = 0; i < NUM_ENCODERS; i++)
+    hci->max_encoder[i] = cache.max_encoder[i];
+  memcpy(arm->param_block, cache.param_block, PARAM_BLOCK_SIZE);
+  arm->p_block_size = cache.p_block_size;
+  memcpy(arm->ext_param_block, cache.ext_param_block, EXT_PARAM_BLOCK_SIZE);
+  arm->ext_p_block_size = cache.ext_p_block_size;
+
+  return 1;
+}
+
+
+/* arm_save_cache() saves the constants downloaded from the connected Arm,
+     so that arm_load_cache() can restore them on the next connect.
+     A failure to save is not an error; the next connect just downloads
+     the constants again.
+*/
+void arm_save_cache(arm_rec *arm)
+{
+  arm_cache_rec cache;
+  hci_rec *hci = &arm->hci;
+  int i;
+
+  memset(&cache, 0, sizeof(cache));
+  cache.size = sizeof(cache);
+  hci_strcopy(hci->serial_number, cache.serial_number);
+  hci_strcopy(hci->version, cache.version);
+  hci_strcopy(hci->product_name, cache.product_name);
+  hci_strcopy(hci->product_id, cache.product_id);
+  hci_strcopy(hci->model_name, cache.model_name);
+  hci_strcopy(hci->comment, cache.comment);
+  hci_strcopy(hci->param_format, cache.param_format);
+  for (i = 0; i < NUM_BUTTONS; i++)
+    cache.button_supported[i] = hci->button_supported[i];
+  cache.max_timer = hci->max_timer;
+  for (i = 0; i < NUM_ANALOGS; i++)
+    cache.max_analog[i] = hci->max_analog[i];
+  for (i = 0; i < NUM_ENCODERS; i++)
+    cache.max_encoder[i] = hci->max_encoder[i];
+  memcpy(cache.param_block, arm->param_block, PARAM_BLOCK_SIZE);
+  cache.p_block_size = arm->p_block_size;
+  memcpy(cache.ext_param_block, arm->ext_param_block, EXT_PARAM_BLOCK_SIZE);
+  cache.ext_p_block_size = arm->ext_p_block_size;
+
+  host_save_cache(hci->serial_number, &cache, sizeof(cache));
+}
+
+
 /* arm_get_constants() gets all constants for this individual Arm.
      This is called by arm_connect() to get all constants at the beginning
-     of a session.
+     of a session.  After arm_use_cache() they come from the calibration
+     cache when it holds this Arm, and are downloaded and saved otherwise.
 */
 arm_result arm_get_constants(arm_rec *arm)
 {
-  arm_result result;
+  arm_result result = SUCCESS;
+  int cached;
 
-  result = hci_get_strings(&arm->hci);
-  if (result == SUCCESS) {
-    result = hci_get_maxes(&arm->hci);//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-  }
-  if (result == SUCCESS) {
-    result = hci_get_params(&arm->hci,
-             arm->param_block, &arm->p_block_size);
+  cached = arm->use_cache && arm_load_cache(arm);
+  if (!cached)
+  {
+    arm->p_block_size = PARAM_BLOCK_SIZE;    /* room for the download */
+    result = hci_get_constants(&arm->hci, arm->param_block,
+                               &arm->p_block_size);
   }
-  if (result == SUCCESS && strstr(arm->hci.comment, "Beta") != NULL)
+  if (!cached && result == SUCCESS
+      && strstr(arm->hci.comment, "Beta") != NULL)
     result = hci_get_ext_params(&arm->hci, arm->ext_param_block,
                                 &arm->ext_p_block_size);
-    if (result == SUCCESS) result = arm_convert_params(arm);
-    if (result == SUCCESS && strstr(arm->hci.comment, "Beta") != NULL)
-        result = arm_convert_ext_params(arm);
-        if (result == SUCCESS)
-      {
+  if (result == SUCCESS) result = arm_convert_params(arm);
+  if (result == SUCCESS && strstr(arm->hci.comment, "Beta") != NULL)
+    result = arm_convert_ext_params(arm);
+  if (result == SUCCESS && arm->use_cache && !cached)
+    arm_save_cache(arm);
+  if (result == SUCCESS)
+  {
         arm->JOINT_RADIANS_FACTOR[0] = 2.0 * PI / (arm->hci.max_encoder[0] + 1);
           arm->JOINT_RADIANS_FACTOR[1] = 2.0 * PI / (arm->hci.max_encoder[1] + 1);
           arm->JOINT_RADIANS_FACTOR[2] = 2.0 * PI / (arm->hci.max_encoder[2] + 1);
@@ -1426,6 +1927,8 @@ arm_result arm_get_constants(arm_rec *arm)
           arm->JOINT_DEGREES_FACTOR[3] = 360.0 / (arm->hci.max_encoder[3] + 1);
           arm->JOINT_DEGREES_FACTOR[4] = 360.0 / (arm->hci.max_encoder[4] + 1);
           arm->JOINT_DEGREES_FACTOR[5] = 360.0 / (arm->hci.max_encoder[5] + 1);
+
+    if (arm->trig_tables != NULL) arm_calc_trig_tables(arm);
         }
 
   return result;
@@ -8,11 +8,43 @@
 */
 
 #include <Arduino.h>
+#ifdef __AVR__
+#include <EEPROM.h>
+#endif
 #include "drive.h"
 
-#define SerialArm Serial1
-
-unsigned long timeout_start;
+#define NUM_PORTS 3
+
+/* UART behind each port number.  Port 1 (Serial1) is the default; on a
+   Mega ports 2 and 3 let more arms run from the same sketch. */
+HardwareSerial *port_serial[NUM_PORTS + 1] = {
+  NULL,
+#ifdef HAVE_HWSERIAL1
+  &Serial1,
+#else
+  NULL,
+#endif
+#ifdef HAVE_HWSERIAL2
+  &Serial2,
+#else
+  NULL,
+#endif
+#ifdef HAVE_HWSERIAL3
+  &Serial3,
+#else
+  NULL,
+#endif
+};
+
+/* The UART of the port argument of the function using it */
+#define SerialArm (*port_serial[port])
+
+/* Timeout length and start time of each port, in usec from micros() */
+unsigned long timeout_usec[NUM_PORTS + 1];
+unsigned long timeout_start[NUM_PORTS + 1];
+
+/* micros() when the read functions last handed out a char of each port */
+unsigned long last_arrival[NUM_PORTS + 1];
 
 
 /*------------------*/
@@ -30,30 +62,51 @@ void host_pause(float delay_sec) {
 //   H O S T _ G E T _ T I M E O U T
 // host_get_timeout() gets the timeout period of the given port in seconds
 float   host_get_timeout(int port) {
-  return 1;
-  // can't see this function being called anywhere
+  return timeout_usec[port] * 1e-6;
 }
 
 //   H O S T _ S E T _ T I M E O U T
 // host_set_timeout() sets the length of all future timeout periods to the given # of seconds
 void host_set_timeout(int port, float timeout_sec) {
-  SerialArm.setTimeout(timeout_sec * 1000);
+  if (timeout_sec < 0) timeout_sec = 0;
+  timeout_usec[port] = timeout_sec * 1e6;
 }
 
 
 //   H O S T _ S T A R T _ T I M E O U T
 // host_start_timeout() starts a timer for the specified port.
-// Call timed_out_yet() to find out whether time is up.
+// Call host_timed_out() to find out whether time is up.
 void host_start_timeout(int port) {
-  timeout_start = millis();
+  timeout_start[port] = micros();
+}
+
+
+//   H O S T _ C L O C K _ U S E C
+// host_clock_usec() reads a free-running microsecond clock for timing
+// intervals.  It wraps around, so only unsigned differences are meaningful.
+unsigned long host_clock_usec(void) {
+  return micros();
+}
+
+
+//   H O S T _ A R R I V A L _ U S E C
+// host_arrival_usec() returns when the read functions last handed out a
+// char of the port, in usec from micros().  That is the time of the read,
+// not of the char's arrival: the UART interrupt may have buffered it long
+// before.  micros() is 32 bits, so the value wraps around at 2^32 usec
+// (about 71.6 minutes) although it is returned in 64 bits; only unsigned
+// 32-bit differences of it are meaningful, as with host_clock_usec().
+unsigned long long host_arrival_usec(int port) {
+  return last_arrival[port];
 }
 
 
 //   H O S T _ T I M E D _ O U T
 // host_timed_out() returns True if the previously-started timeout
 // period is over.  Returns False if not.
+// The unsigned difference stays correct when micros() wraps around.
 int host_timed_out(int port) {
-  return ((millis() - timeout_start) > 3000);
+  return ((micros() - timeout_start[port]) >= timeout_usec[port]);
 }
 
 
@@ -71,7 +124,40 @@ int host_timed_out(int port) {
 // Takes small arguments as shorthand:
 // 115 --> 115200, 38 or 384 --> 38400, 96 --> 9600 etc.
 void host_fix_baud(long int *baud) {
-  // unify baud rate formats
+  switch (*baud) {
+    case 115200L:
+    case 1152L:
+    case 115L:
+      *baud = 115200L;
+      break;
+    case 57600L:
+    case 576L:
+    case 57L:
+      *baud = 57600L;
+      break;
+    case 38400L:
+    case 384L:
+    case 38L:
+      *baud = 38400L;
+      break;
+    case 19200L:
+    case 192L:
+    case 19L:
+      *baud = 19200L;
+      break;
+    case 9600L:
+    case 96L:
+      *baud = 9600L;
+      break;
+    default:
+      if (*baud < 1000L) *baud *= 1000;
+      if (*baud > 86400L) *baud = 115200L;
+      else if (*baud > 48000L) *baud = 57600L;
+      else if (*baud > 28800L) *baud = 38400L;
+      else if (*baud > 14400L) *baud = 19200L;
+      else *baud = 9600L;
+      break;
+  }
 }
 
 /*--------------------------*/
@@ -100,6 +186,21 @@ void host_close_serial(int port) {
 }
 
 
+//   H O S T _ S E T _ B A U D
+// host_set_baud() changes the line speed of an open port once the chars
+// already written have gone out.  begin() on a running UART only sets its
+// rate, so the chars received so far are kept.
+// Returns False (zero) if the speed could not be set
+int host_set_baud(int port, long int baud) {
+  if (baud == 0) {
+    return 0;
+  }
+  SerialArm.flush();
+  SerialArm.begin(baud);
+  return 1;
+}
+
+
 //   H O S T _ F L U S H _ S E R I A L
 // host_flush_serial() flushes and resets the serial i/o buffers
 void host_flush_serial(int port) {
@@ -119,6 +220,7 @@ void host_flush_serial(int port) {
 int host_read_char(int port) {
   if (SerialArm.available() > 0) {
     int ch = SerialArm.read();
+    last_arrival[port] = micros();
     /*
     Serial.print(" ("); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
     Serial.print(ch, HEX); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
@@ -133,6 +235,31 @@ int host_read_char(int port) {
 }
 
 
+//   H O S T _ R E A D _ B U F F E R E D
+// host_read_buffered() reads one character that the driver already
+// holds.  The UART's receive buffer is in RAM, so this is host_read_char().
+// returns -1 if nothing is buffered
+int host_read_buffered(int port) {
+  return host_read_char(port);
+}
+
+
+//   H O S T _ R E A D _ A V A I L A B L E
+// host_read_available() copies up to max chars that have already
+// arrived into buf without waiting.  Returns # of chars copied.
+int host_read_available(int port, char *buf, int max) {
+  int count = SerialArm.available();
+  if (count > max) {
+    count = max;
+  }
+  if (count <= 0) {
+    return 0;
+  }
+  last_arrival[port] = micros();
+  return SerialArm.readBytes(buf, count);
+}
+
+
 //   H O S T _ R E A D _ B Y T E S
 // host_read_bytes() will try to read a specified number of bytes
 // until the timeout period of time expires.  It returns the number
@@ -142,7 +269,6 @@ int host_read_bytes(int port, char *buf, int count, float timeout) {
   // Serial.print("HOST_READ_BYTES");
   // return SerialArm.readBytesUntil('\0', buf, count);
   int read;
-  int ch;
 
   /* setup the timeout */
   read = 0;
@@ -151,12 +277,9 @@ int host_read_bytes(int port, char *buf, int count, float timeout) {
 
   while (!host_timed_out(port))
   {
-    if ((ch = host_read_char(port)) != -1) {
-      *buf = (char) ch;
-      buf++;
-      if (++read == count)
-        break;
-    }
+    read += host_read_available(port, buf + read, count - read);
+    if (read == count)
+      break;
   }
 
   return read;
@@ -188,6 +311,14 @@ int host_write_string(int port, char *str) {
   // Is this correct? Should NULL be added?
 }
 
+//   H O S T _ W R I T E _ B Y T E S
+// host_write_bytes() writes count chars from buf in one call
+// Returns True (non-zero) if successful
+int host_write_bytes(int port, char *buf, int count) {
+  SerialArm.write((const uint8_t *) buf, count);
+  return 1;
+}
+
 /*----------------------------*/
 /* Getting Serial Port Status */
 /*----------------------------*/
@@ -196,7 +327,7 @@ int host_write_string(int port, char *str) {
 //   H O S T _ P O R T _ V A L I D
 // host_port_valid() returns True if the specified port number is valid
 int host_port_valid(int port) {
-  return (SerialArm);
+  return (port > 0) && (port <= NUM_PORTS) && port_serial[port] != NULL;
 }
 
 
@@ -208,6 +339,79 @@ int host_input_count(int port) {
 
 //   H O S T _ I N P U T _ F U L L
 // host_input_full() tells whether or not the serial input queue is full
-int host_input_full() {
+int host_input_full(int port) {
   return ((64 - SerialArm.available()) == 0);
 }
+
+
+/*-------------------*/
+/* Calibration Cache */
+/*-------------------*/
+
+// The cache lives in EEPROM from CACHE_ADDR on: the key, zero-padded to
+// CACHE_KEY_SIZE chars, then the record.  It holds one record, the last
+// one saved.  Boards without EEPROM have no cache.
+#define CACHE_ADDR      0
+#define CACHE_KEY_SIZE  32
+
+
+//   H O S T _ L O A D _ C A C H E
+// host_load_cache() reads the record saved under key into buf.
+// Returns False (zero) unless the EEPROM holds one for this key.
+int host_load_cache(char *key, void *buf, int size) {
+#ifdef __AVR__
+  int i;
+
+  if (CACHE_ADDR + CACHE_KEY_SIZE + size > (int) EEPROM.length()) {
+    return 0;
+  }
+  for (i = 0; i < CACHE_KEY_SIZE; i++) {
+    if (EEPROM.read(CACHE_ADDR + i) != (uint8_t) key[i]) {
+      return 0;
+    }
+    if (key[i] == 0) {
+      break;
+    }
+  }
+  if (i == CACHE_KEY_SIZE) {
+    return 0;
+  }
+  for (i = 0; i < size; i++) {
+    ((uint8_t *) buf)[i] = EEPROM.read(CACHE_ADDR + CACHE_KEY_SIZE + i);
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+//   H O S T _ S A V E _ C A C H E
+// host_save_cache() saves size bytes of buf under key, replacing the
+// record there.  The key is cleared first and written last, so an
+// interrupted save leaves no record rather than a broken one.
+// Only changed bytes are written, to spare the EEPROM.
+// Returns False (zero) if it does not fit.
+int host_save_cache(char *key, void *buf, int size) {
+#ifdef __AVR__
+  int i, end = 0;
+
+  if (CACHE_ADDR + CACHE_KEY_SIZE + size > (int) EEPROM.length()
+      || strlen(key) >= CACHE_KEY_SIZE) {
+    return 0;
+  }
+  EEPROM.update(CACHE_ADDR, 0xFF);
+  for (i = 0; i < size; i++) {
+    EEPROM.update(CACHE_ADDR + CACHE_KEY_SIZE + i, ((uint8_t *) buf)[i]);
+  }
+  for (i = CACHE_KEY_SIZE - 1; i >= 0; i--) {
+    if (!end && key[i] == 0) {
+      end = 1;
+    }
+    EEPROM.update(CACHE_ADDR + i, end ? 0 : (uint8_t) key[i]);
+  }
+  return 1;
+#else
+  return 0;
+#endif
+}
@@ -17,7 +17,8 @@
 
 
 /* Public constants */
-#define MIN_TIMEOUT     0.1
+/* Floor for hci fast_timeout (sec); Serial1 has no extra latency */
+#define MIN_TIMEOUT     0.01
 
 /* this was put in for windows only */
 int host_get_id(int port);
@@ -29,20 +30,31 @@ float   host_get_timeout(int port);
 void    host_set_timeout(int port, float timeout_sec);
 void    host_start_timeout(int port);
 int     host_timed_out(int port);
+unsigned long host_clock_usec(void);
+unsigned long long host_arrival_usec(int port);
 
 
 /* Configuring serial ports */
 void    host_fix_baud(long int *baud);
 int     host_open_serial(int port, long int baud);
 void    host_close_serial(int port);
+int     host_set_baud(int port, long int baud);
 void    host_flush_serial(int port);
 
 
 /* Reading/writing serial data */
 int     host_read_char(int port);
+int     host_read_buffered(int port);
 int     host_read_bytes(int port, char *buf, int count, float timeout);
+int     host_read_available(int port, char *buf, int max);
 int     host_write_char(int port, int ch);
 int     host_write_string(int port, char *str);
+int     host_write_bytes(int port, char *buf, int count);
 int     host_port_valid(int port);
 int     host_input_count(int port);
 int     host_input_full(int port);
+
+
+/* Calibration cache, see arm_use_cache() */
+int     host_load_cache(char *key, void *buf, int size);
+int     host_save_cache(char *key, void *buf, int size);
@@ -22,7 +22,8 @@
  R1 OUT to RX1 on the Arduino Mega, pin 19
  R2 OUT -
 
- SerialArm is defined as Serial1 in "drive.cpp" 
+ Port 1 is Serial1 (port 2 = Serial2, port 3 = Serial3), see "drive.cpp".
+ Don't connect an arm to port 3 here, Serial3 is used for MIDI.
 
  5 pin DIN MIDI connections:
  DIN pin 5 through 220 ohm resistor to TX3 on the Arduino Mega, pin 14 
@@ -45,8 +46,9 @@
 # include <drive.h>
 
 arm_rec arm;
+trig_table trig[1];  // room for one encoder resolution, about 780 bytes
 
-long baud = 9600L;
+long baud = 115200L;     // fastest rate to try; signs on at 9600
 int port = 1;
 int note = 0;
 
@@ -63,8 +65,10 @@ void setup() {
   // Initialize and connect Microscribe arm
   arm_init(&arm);
   arm_install_simple(&arm);
+  arm_use_cache(&arm);  // constants from EEPROM after the first connect
+  arm_use_trig_tables(&arm, trig, 1);  // no sin()/cos() per packet on the AVR
   arm_result result;
-  result = arm_connect(&arm, port, baud);
+  result = arm_connect_fastest(&arm, port, baud);
   
 }
 
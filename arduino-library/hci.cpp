@@ -14,6 +14,7 @@
 
 #include <Arduino.h>
 #include <stdio.h>
+#include <string.h>
 #include "hci.h"
 #include "drive.h"
 
@@ -57,32 +58,87 @@ int     num_cfg_args;   /* The # of valid bytes stored in cfg_args[] */
 char    SIGNON_STR[5] = "IMMC";
 char    BEGIN_STR[6] = "BEGIN";
 
-/* Result Codes for which there are no error handlers */
-char    SUCCESS[8] = "Success";
-char    NO_PACKET_YET[32] = "Current packet not yet complete";
-char    TRY_AGAIN[29] = "Try this HCI operation again";
-/* TRY_AGAIN[] is provided for use by modules built on hci.c.  This
- *   hci module does not directly use TRY_AGAIN[].  The idea is to
+/* Text of each hci_result, in the order of the enum in hci.h.
+ *   SUCCESS and NO_PACKET_YET have no error handlers.
+ *   TRY_AGAIN is provided for use by modules built on hci.c.  This
+ *   hci module does not directly use TRY_AGAIN.  The idea is to
  *   have error handlers return TRY_AGAIN if an error has been fixed
  *   (such as getting a new port # from user).  Then higher-level modules
  *   should respond to TRY_AGAIN by repeating whatever they were trying
  *   to do when the error occured.
  */
+static const char *result_strings[NUM_HCI_RESULTS] =
+{
+	"Success",
+	"Current packet not yet complete",
+	"Try this HCI operation again",
+	"Timed out waiting for packet",
+	"Port number out of range",
+	"Corrupted packet",
+	"Unable to find HCI",
+	"Found HCI but can't begin session",
+	"Unable to open serial port",
+	"Password rejected during config command",
+	"Firmware version does not support this feature",
+	"Unknown firmware parameter format"
+};
 
-/* Result Codes for which there are error handlers
- */
-char    TIMED_OUT[29] = "Timed out waiting for packet";
-char    BAD_PORT_NUM[25] = "Port number out of range";
-char    BAD_PACKET[17] = "Corrupted packet";
-char    NO_HCI[19] = "Unable to find HCI";
-char    CANT_BEGIN[34] = "Found HCI but can't begin session";
-char    CANT_OPEN_PORT[27] = "Unable to open serial port";
-char    BAD_PASSWORD[40] = "Password rejected during config command";
-char    BAD_VERSION[47] = "Firmware version does not support this feature";
-char    BAD_FORMAT[34] = "Unknown firmware parameter format";
 
+/*------------------*/
+/* Packet layouts   */
+/*------------------*/
 
-int packet_size(int cmd);
+/* A standard cmd byte holds a timer bit, 2 analog bits and 2 encoder bits,
+ *   so there are only 64 packet layouts.  The macros below work each one
+ *   out at compile time; the parser just looks it up.
+ * Data bytes of a standard packet, in order:
+ *   buttons, timer (2), A/D values (1 each) and their LSB byte,
+ *   encoder counts (2 each).
+ */
+typedef struct {
+	unsigned short present; /* SAMPLE_ bits of the fields in the packet */
+	byte    size;           /* # of data bytes after the cmd byte */
+	byte    timer;          /* 1 if a timer value follows the buttons */
+	byte    analogs;        /* # of A/D values */
+	byte    encoders;       /* # of encoder counts, always the last field */
+} std_layout;
+
+#define STD_CMD_MASK    (CONFIG_BIT - 1)
+
+#define LAYOUT_TIMER(c)     ((c) & TIMER_BIT ? 1 : 0)
+#define LAYOUT_ANALOGS(c)   (((c) & ANALOG_BITS) == ANALOG_BITS ? 8 : \
+								 ((c) & ANALOG_BITS) >> 1)
+#define LAYOUT_ENCODERS(c)  (((c) & ENCODER_BITS) == ENCODER_LO_BIT ? 5 : \
+								 ((c) & ENCODER_BITS) == ENCODER_HI_BIT ? 7 : \
+								 ((c) & ENCODER_BITS) ? 6 : 0)
+#define STD_LAYOUT(c)                                       \
+	{   (LAYOUT_TIMER(c) ? SAMPLE_TIMER : 0)                \
+		  | (SAMPLE_ANALOG(LAYOUT_ANALOGS(c)) - SAMPLE_ANALOG(0)) \
+		  | (SAMPLE_ENCODER(LAYOUT_ENCODERS(c)) - 1),       \
+		1 + 2 * LAYOUT_TIMER(c)                             \
+		  + LAYOUT_ANALOGS(c) + (LAYOUT_ANALOGS(c) ? 1 : 0) \
+		  + 2 * LAYOUT_ENCODERS(c),                         \
+		LAYOUT_TIMER(c), LAYOUT_ANALOGS(c), LAYOUT_ENCODERS(c) }
+#define STD_LAYOUT4(c)  STD_LAYOUT(c), STD_LAYOUT((c) + 1), \
+						STD_LAYOUT((c) + 2), STD_LAYOUT((c) + 3)
+#define STD_LAYOUT16(c) STD_LAYOUT4(c), STD_LAYOUT4((c) + 4), \
+						STD_LAYOUT4((c) + 8), STD_LAYOUT4((c) + 12)
+
+static void decode_sample(packet_rec *pk, hci_sample *s);
+static char *string_field(hci_rec *hci, int cmnd);
+static int reply_char(hci_rec *hci, float timeout);
+static void stats_request(hci_rec *hci, int size);
+static void stats_first_byte(hci_rec *hci);
+static void stats_packet(hci_rec *hci);
+static void stats_error(hci_rec *hci, hci_result condition);
+
+/* hci_sample is written to files and queues as it is: keep it 48 bytes */
+typedef char hci_sample_size_check[sizeof(hci_sample) == 48 ? 1 : -1];
+
+static const std_layout std_layouts[STD_CMD_MASK + 1] PROGMEM =
+{
+	STD_LAYOUT16(0x00), STD_LAYOUT16(0x10), STD_LAYOUT16(0x20), STD_LAYOUT16(0x30)
+};
 
 
 /*-------------------*/
@@ -99,7 +155,11 @@ void hci_clear_packet(hci_rec *hci)
 	hci->packet.parsed = 1;
 	hci->packet.error = 0;
 	hci->packet.data_ptr = hci->packet.data;
+	hci->packet.spare_at = 0;
+	hci->packet.num_spare = 0;
 	hci->packets_expected = 0;
+	if (hci->link_stats != NULL)   /* requests in flight are forgotten */
+		hci->link_stats->num_answered = hci->link_stats->num_sent;
 }
 
 
@@ -123,8 +183,14 @@ void hci_com_params(hci_rec *hci, int port, long int baud)
  */
 void hci_init(hci_rec *hci, int port, long int baud)
 {
+	int i;
+
 	hci_com_params(hci, port, baud);
 	hci_clear_packet(hci);
+	hci->bytes_dropped = 0;
+	hci->packets_dropped = 0;
+	hci->signon_baud = 0;
+	hci->signon_usec = 0;
 
 	/* Set all descr. strings to null strings */
 	hci->serial_number[0] = 0;
@@ -136,17 +202,16 @@ void hci_init(hci_rec *hci, int port, long int baud)
 	hci->version[0] = 0;
 
 	/* By default, no error handlers are installed */
-	hci->BAD_PORT_handler = NULL;
-	hci->CANT_OPEN_handler = NULL;
-	hci->NO_HCI_handler = NULL;
-	hci->CANT_BEGIN_handler = NULL;
-	hci->TIMED_OUT_handler = NULL;
-	hci->BAD_PACKET_handler = NULL;
-	hci->BAD_VERSION_handler = NULL;
-	hci->BAD_FORMAT_handler = NULL;
+	for (i = 0; i < NUM_HCI_RESULTS; i++)
+	{
+		hci->handler[i] = NULL;
+		hci->result_count[i] = 0;
+	}
 
 	hci->default_handler = NULL;
 
+	hci->link_stats = NULL;
+
 	/* This field is free for the user's own purpose */
 	hci->user_data = (long int) 0;
 }
@@ -207,35 +272,61 @@ hci_result hci_connect(hci_rec *hci)
 }
 
 
+/* Rates hci_autosynch() tries for an Arm left in a session at another
+ *   rate, fastest first since hci_upgrade_baud() leaves it there */
+static long int signon_rates[] = { 115200l, 57600l, 38400l, 19200, 9600, 0 };
+
+
 /* hci_autosynch() leads the Immersion HCI through the baudrate
  *    auto-synch process.  This requires that the HCI was either
  *    just powered-on or has just been given an END_SESSION command,
  *    such as by a previous call to hci_end().
+ *    Each attempt ends any session first, and returns as soon as the
+ *    signon echo arrives.  If no echo arrives in time, the next attempt
+ *    ends the session at one of signon_rates[], for an Arm still running
+ *    a session at another rate.  Only the line speed is switched for it;
+ *    the port stays open.  Gives up after the slow timeout.
+ *    Sets signon_baud to the rate the Arm was found at and signon_usec
+ *    to the time it took.
  */
 hci_result hci_autosynch(hci_rec *hci)
 {
-	int ch, port = hci->port_num;
-	char *sign_ch = SIGNON_STR;
-	int  signed_on = 0;
-
-	host_start_timeout(port);
-	while ( !signed_on && !host_timed_out(port) )
+	int port = hci->port_num;
+	char ch, *sign_ch = SIGNON_STR;
+	int  signed_on = 0, scanned, next = 0;
+	long int rate = hci->baud_rate, echo_rate = 0;
+	float saved_timeout = host_get_timeout(port);
+	float wait = SIGNON_WAIT + SIGNON_CHARS * 10.0 / hci->baud_rate;
+	unsigned long limit = (unsigned long) (hci->slow_timeout * 1e6);
+	unsigned long start = host_clock_usec();
+
+	hci->signon_baud = 0;
+	host_flush_serial(port);        /* A stale echo must not count */
+	while ( !signed_on && host_clock_usec() - start < limit )
 	{
-		hci_end(hci);   /* In case session wasn't ended before */
+		/* End a session the Arm may still be in, at its rate */
+		if (rate != hci->baud_rate)
+			host_set_baud(port, rate);
+		hci_end(hci);
+		if (rate != hci->baud_rate)
+			host_set_baud(port, hci->baud_rate);
 		host_write_string(port, SIGNON_STR);
-    Serial.print("<"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-    Serial.print(SIGNON_STR); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-    Serial.println(">"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-		host_pause(SIGNON_PAUSE);
-		while (((ch=host_read_char(port)) != -1) && !signed_on)
+
+		/* Scan the echo as it arrives, without a fixed pause.
+		 *   A late echo can finish the match in the next attempt, unless
+		 *   it arrives while the line runs at another rate.  The rate is
+		 *   credited to the attempt whose echo started the match. */
+		scanned = 0;
+		while (!signed_on && scanned++ < SIGNON_SCAN
+			&& host_read_bytes(port, &ch, 1, wait) == 1)
 		{
-      
 			if (ch == *sign_ch)
 			{
+				if (sign_ch == SIGNON_STR) echo_rate = rate;
 				if (!*++sign_ch)
 				{
 					signed_on = 1;
-          
+					hci->signon_baud = echo_rate;
 				}
 			}
 			else
@@ -243,8 +334,19 @@ hci_result hci_autosynch(hci_rec *hci)
 				sign_ch = SIGNON_STR;
 			}
 		}
+
+		/* Pick the rate to end the session at next time */
+		if (!signed_on)
+		{
+			rate = signon_rates[next];
+			next = rate ? next + 1 : 0;
+			if (rate == 0) rate = hci->baud_rate;
+		}
 	}
 	host_flush_serial(port);        /* Get rid of excess SIGNON strings in buffer */
+	hci_clear_packet(hci);          /* and of a char peeked before them */
+	host_set_timeout(port, saved_timeout);
+	hci->signon_usec = host_clock_usec() - start;
 
 	if (signed_on) return SUCCESS;
 	else return NO_HCI;
@@ -260,14 +362,8 @@ hci_result hci_begin(hci_rec *hci)
 	int port = hci->port_num;
 
 	host_write_string(port, BEGIN_STR);
-  Serial.println();
-  Serial.print("<"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-  Serial.print(BEGIN_STR); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-  Serial.println(">"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-	if (hci_read_string(hci, hci->product_id) == SUCCESS) {
-		
-		return SUCCESS; //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-	}
+	if (hci_read_string(hci, hci->product_id) == SUCCESS)
+		return SUCCESS;
 	else
 		return CANT_BEGIN;
 }
@@ -290,6 +386,7 @@ void hci_end(hci_rec *hci)
 void hci_disconnect(hci_rec *hci)
 {
 	host_flush_serial(hci->port_num);
+	hci_clear_packet(hci);
 	hci_end(hci);
 	host_pause(END_PAUSE);
 	host_close_serial(hci->port_num);
@@ -298,7 +395,7 @@ void hci_disconnect(hci_rec *hci)
 
 /* hci_reset_com() clears the host serial i/o buffers.
  *   This often helps to recover from a BAD_PACKET error and may be useful
- *     in a user-defined BAD_PACKET_handler.
+ *     in a user-defined handler[BAD_PACKET].
  */
 void hci_reset_com(hci_rec *hci)
 {
@@ -315,14 +412,115 @@ void hci_change_baud(hci_rec *hci, long int new_baud)
 {
 	byte baud_code;
 
+	byte cmd[2];
+
 	host_fix_baud(&new_baud);
 	baud_code = baud_to_code(new_baud);
 	new_baud = code_to_baud(baud_code);
-	host_write_char(hci->port_num, SET_BAUD);
-	host_write_char(hci->port_num, baud_code);
+	cmd[0] = SET_BAUD;
+	cmd[1] = baud_code;
+	host_write_bytes(hci->port_num, (char *) cmd, 2);
 	host_pause(END_PAUSE);
 	host_close_serial(hci->port_num);
 	host_open_serial(hci->port_num, new_baud);
+
+	/* Keep baud_rate and fast_timeout in step with the new rate */
+	hci_com_params(hci, hci->port_num, new_baud);
+}
+
+
+/* hci_verify_link() sends a burst of standard requests, a few at a time,
+ *   and returns SUCCESS only if every reply comes back intact.
+ *   Failures are NOT passed to the error handlers; this is a probe.
+ */
+hci_result hci_verify_link(hci_rec *hci, int burst)
+{
+	hci_result result = SUCCESS;
+	int     sent = 0, got = 0, i;
+	int     port = hci->port_num;
+	byte    cmnd = CMD_BYTE(1, 0, 6);   /* timer and 6 encoders */
+	long int dropped = hci->bytes_dropped;
+
+	hci_clear_packet(hci);
+	while (got < burst && result == SUCCESS)
+	{
+		while (sent < burst && sent - got < VERIFY_DEPTH)
+		{
+			hci_std_cmd(hci, 1, 0, 6);
+			sent++;
+		}
+
+		hci_fast_timeout(hci);
+		host_start_timeout(port);
+		while ((result = hci_build_packet(hci, HCI_CHECK_FGND)) == NO_PACKET_YET)
+		{
+			if (host_timed_out(port))
+			{
+				result = TIMED_OUT;
+				break;
+			}
+		}
+		if (result != SUCCESS) break;
+
+		/* A garbled byte usually shows up as a wrong cmd or a high bit */
+		if (hci->packet.error || hci->packet.cmd_byte != (PACKET_MARKER | cmnd))
+			result = BAD_PACKET;
+		for (i = 0; i < hci_packet_size(PACKET_MARKER | cmnd); i++)
+			if (hci->packet.data[i] & 0x80) result = BAD_PACKET;
+		hci->packet.parsed = 1;
+		got++;
+	}
+
+		/* The parser skips noise by itself; it must not have had to */
+	if (result == SUCCESS && hci->bytes_dropped != dropped)
+		result = BAD_PACKET;
+
+	if (result != SUCCESS) hci_reset_com(hci);
+	return result;
+}
+
+
+/* hci_upgrade_baud() steps the HCI and host up through the standard baud
+ *   rates, up to max_baud, and keeps the fastest one at which a burst of
+ *   test packets arrives without a single error.  If a rate fails, both
+ *   sides go back to the last good one.  Call right after hci_connect().
+ *   Returns SUCCESS with the rate in use in hci->baud_rate.
+ */
+hci_result hci_upgrade_baud(hci_rec *hci, long int max_baud, int burst)
+{
+	static long int rates[] = { 9600, 19200, 38400l, 57600l, 115200l, 0 };
+	long int good = hci->baud_rate;
+	int     i, tries;
+
+	host_fix_baud(&max_baud);
+	for (i = 0; rates[i] && rates[i] <= max_baud; i++)
+	{
+		if (rates[i] <= good) continue;
+
+		hci_change_baud(hci, rates[i]);
+		if (hci_verify_link(hci, burst) == SUCCESS)
+		{
+			good = rates[i];
+			continue;
+		}
+
+		/* Too fast: the SET_BAUD itself may get garbled, so insist */
+		for (tries = 0; tries < 3; tries++)
+		{
+			hci_change_baud(hci, good);
+			if (hci_verify_link(hci, burst) == SUCCESS)
+				return SUCCESS;
+			hci_com_params(hci, hci->port_num, rates[i]);
+			host_close_serial(hci->port_num);
+			host_open_serial(hci->port_num, rates[i]);
+		}
+		hci_com_params(hci, hci->port_num, good);
+		host_close_serial(hci->port_num);
+		host_open_serial(hci->port_num, good);
+		return hci_error(hci, TIMED_OUT);
+	}
+
+	return SUCCESS;
 }
 
 
@@ -345,6 +543,66 @@ hci_result hci_get_strings(hci_rec *hci)
 }
 
 
+/* hci_get_constants() gets all descriptor strings, the max field values
+ *    and the main parameter block (stored in block) in one exchange.
+ *    All the cmds go out back-to-back and the replies are taken as they
+ *    stream in, so the link never sits idle waiting on a round trip.
+ *    Same results as hci_get_strings(), hci_get_maxes() and
+ *    hci_get_params() one after another.
+ *    *block_size gives the room in block on entry; a block longer than
+ *    that is a BAD_PACKET and is not read.
+ */
+hci_result hci_get_constants(hci_rec *hci, byte *block, int *block_size)
+{
+	static const byte cmds[] = { GET_PROD_NAME, GET_PROD_ID, GET_MODEL_NAME,
+		GET_SERNUM, GET_COMMENT, GET_PRM_FORMAT, GET_VERSION,
+		GET_MAXES, GET_PARAMS };
+	int port = hci->port_num, i, n, ch;
+	char *str;
+
+	host_write_bytes(port, (char *) cmds, sizeof(cmds));
+
+	for (i = 0; i < (int) sizeof(cmds); i++)
+	{
+			/* each reply starts with its own cmd byte */
+		while ( (ch = reply_char(hci, hci->fast_timeout)) != cmds[i])
+			if (ch == -1) return hci_error(hci, TIMED_OUT);
+
+		if ( (str = string_field(hci, cmds[i])) != NULL)
+		{
+			n = 0;
+			while ( (ch = reply_char(hci, hci->fast_timeout)) != 0)
+			{
+				if (ch == -1) return hci_error(hci, TIMED_OUT);
+				if (n < MAX_STRING_SIZE - 1) str[n++] = (char) ch;
+			}
+			str[n] = 0;
+		}
+		else if (cmds[i] == GET_MAXES)
+		{
+			n = hci_packet_size(GET_MAXES);
+			if (host_read_bytes(port, (char *) hci->packet.data, n,
+									hci->slow_timeout) != n)
+				return hci_error(hci, TIMED_OUT);
+			hci->packet.cmd_byte = GET_MAXES;
+			hci_parse_cfg_packet(hci);
+		}
+		else
+		{
+				/* GET_PARAMS: a length byte, then the block */
+			n = reply_char(hci, hci->slow_timeout);
+			if (n > *block_size) return hci_error(hci, BAD_PACKET);
+			if (n == -1 || host_read_bytes(port, (char *) block, n,
+												hci->slow_timeout) != n)
+				return hci_error(hci, TIMED_OUT);
+			*block_size = n;
+		}
+	}
+
+	return SUCCESS;
+}
+
+
 
 /*-------------------*/
 /* Issuing commands */
@@ -368,6 +626,7 @@ void hci_std_cmd(hci_rec *hci, int timer_flag, int analog_reports,
 		hci_fast_timeout(hci);
 		host_start_timeout(hci->port_num);
 	}
+	stats_request(hci, 1);
 }
 
 
@@ -386,6 +645,7 @@ void hci_simple_cfg_cmd(hci_rec *hci, byte cmnd)
 		hci_fast_timeout(hci);
 		host_start_timeout(hci->port_num);
 	}
+	stats_request(hci, 1);
 }
 
 
@@ -483,8 +743,19 @@ hci_result hci_get_maxes(hci_rec *hci)
  */
 void hci_insert_marker(hci_rec *hci, byte marker)
 {
-	hci_simple_cfg_cmd(hci, INSERT_MARKER);
-	host_write_char(hci->port_num, marker);
+	byte cmd[2];
+
+	cmd[0] = INSERT_MARKER;
+	cmd[1] = marker;
+	host_write_bytes(hci->port_num, (char *) cmd, 2);
+
+	/* If there are no pending packets, start timing this one */
+	if (! hci->packets_expected++)
+	{
+		hci_fast_timeout(hci);
+		host_start_timeout(hci->port_num);
+	}
+	stats_request(hci, 2);
 }
 
 
@@ -494,6 +765,7 @@ hci_result hci_string_cmd(hci_rec *hci, byte cmnd)
 {
 	hci_result result;
 	int ch, port = hci->port_num;
+	char *str;
 
 	host_write_char(port, cmnd);
 	hci_fast_timeout(hci);
@@ -505,33 +777,10 @@ hci_result hci_string_cmd(hci_rec *hci, byte cmnd)
 	}
 	if (ch != cmnd) return hci_error(hci, TIMED_OUT);
 
-	switch (cmnd)
-	{
-		case GET_PROD_NAME:
-			result = hci_read_string(hci, hci->product_name);
-			break;
-		case GET_PROD_ID:
-			result = hci_read_string(hci, hci->product_id);
-			break;
-		case GET_MODEL_NAME:
-			result = hci_read_string(hci, hci->model_name);
-			break;
-		case GET_SERNUM:
-			result = hci_read_string(hci, hci->serial_number);
-			break;
-		case GET_COMMENT:
-			result = hci_read_string(hci, hci->comment);
-			break;
-		case GET_PRM_FORMAT:
-			result = hci_read_string(hci, hci->param_format);
-			break;
-		case GET_VERSION:
-			result = hci_read_string(hci, hci->version);
-			break;
-		default:
-			result = SUCCESS;
-			break;
-	}
+	if ( (str = string_field(hci, cmnd)) != NULL)
+		result = hci_read_string(hci, str);
+	else
+		result = SUCCESS;
 
 	return result;
 }
@@ -555,16 +804,18 @@ hci_result hci_passwd_cmd(hci_rec *hci, byte cmnd)
 	}
 	if (ch == cmnd)
 	{
-		host_write_string(port, hci->serial_number);
-		host_write_char(port, 0x00);    /* Write the null to terminate */
+		/* Password is the serial number including its terminating null */
+		i = 0;
+		while (hci->serial_number[i++])
+			;
+		host_write_bytes(port, hci->serial_number, i);
 		host_start_timeout(port);
 		while( (ch=host_read_char(port)) == -1)
 			if (host_timed_out(port)) break;
 		if (ch == -1) return hci_error(hci, TIMED_OUT);
 		else if (ch == PASSWD_OK)
 		{
-			for(i=0; i<num_cfg_args; i++)
-				host_write_char(hci->port_num, cfg_args[i]);
+			host_write_bytes(port, (char *) cfg_args, num_cfg_args);
 			for(i=0; i<num_cfg_args; i++)
 				host_pause(CFG_ARG_PAUSE);
 			return SUCCESS;
@@ -652,25 +903,26 @@ void hci_report_motion(hci_rec *hci, int timer_flag, int analog_reports,
 		int *analog_deltas, int *encoder_deltas)
 {
 	byte    cmnd = CMD_BYTE(timer_flag, analog_reports, encoder_reports);
-	int     port = hci->port_num, i;
-
-	host_write_char(port, REPORT_MOTION);
-	host_write_char(port, delay >> 8);
-	host_write_char(port, delay & 0x00FF);
-	host_write_char(port, cmnd);
-	host_write_char(port, active_btns);
+	byte    out[MAX_CFG_SIZE];      /* Whole command goes out in one write */
+	byte    *op = out;
+	int     i, num_encoders;
+
+	*op++ = REPORT_MOTION;
+	*op++ = delay >> 8;
+	*op++ = delay & 0x00FF;
+	*op++ = cmnd;
+	*op++ = active_btns;
 	for (i=0; i<NUM_ANALOGS; i++)
-		host_write_char(port, analog_deltas[i]);
+		*op++ = analog_deltas[i];
 	if (encoder_reports < NUM_ENCODERS)
-		for (i=0; i<(NUM_ENCODERS-1); i++) {
-			host_write_char(port, encoder_deltas[i] >> 8);
-			host_write_char(port, encoder_deltas[i] & 0x00FF);
-		}
+		num_encoders = NUM_ENCODERS-1;
 	else
-		for (i=0; i<NUM_ENCODERS; i++) {
-			host_write_char(port, encoder_deltas[i] >> 8);
-			host_write_char(port, encoder_deltas[i] & 0x00FF);
-		}
+		num_encoders = NUM_ENCODERS;
+	for (i=0; i<num_encoders; i++) {
+		*op++ = encoder_deltas[i] >> 8;
+		*op++ = encoder_deltas[i] & 0x00FF;
+	}
+	host_write_bytes(hci->port_num, (char *) out, op - out);
 }
 
 
@@ -684,6 +936,7 @@ void hci_end_motion(hci_rec *hci)
 	host_write_char(port, 0);
 	host_pause(5e-2);
 	host_flush_serial(port);
+	hci_clear_packet(hci);
 }
 
 
@@ -748,21 +1001,18 @@ hci_result hci_wait_packet(hci_rec *hci)
 hci_result hci_check_packet(hci_rec *hci, int checkType)
 {
 	hci_result result;
-  //Serial.println("HCI check packet"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
 	if ((result = hci_build_packet(hci,checkType)) == SUCCESS)
 	{
-		Serial.println("Build"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-		if ((result = hci_parse_packet(hci)) == SUCCESS) {
-			Serial.println("Parse"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+		if ((result = hci_parse_packet(hci)) == SUCCESS)
 			return result;
-		}
 		else
 			return hci_error(hci, result);
 	}
 	else
 	{
 		if (result == TIMED_OUT || host_timed_out(hci->port_num))
-			return hci_error(hci, TIMED_OUT);//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+			return hci_error(hci, TIMED_OUT);
 		else
 			return NO_PACKET_YET;
 	}
@@ -788,115 +1038,215 @@ hci_result hci_check_motion(hci_rec *hci)
 		return NO_PACKET_YET;
 }
 
+/* hci_read_motion() takes every packet already buffered, in one pass, and
+ *   decodes each complete standard packet into the next of up to max
+ *   samples, oldest first.  The hci_rec fields are set from the newest
+ *   one only.  A packet still arriving is kept for the next call; config
+ *   packets (e.g. markers) are parsed into the hci_rec as usual.
+ *   Never waits.  Returns the # of samples stored.
+ */
+int hci_read_motion(hci_rec *hci, hci_sample *samples, int max)
+{
+	hci_result result;
+	int n = 0;
+
+	while (n < max && hci_build_packet(hci, HCI_CHECK_MOTION) == SUCCESS)
+	{
+		if ((result = hci_parse_sample(hci, &samples[n])) == SUCCESS)
+			n++;
+		else if (result != NO_PACKET_YET)
+			break;
+	}
+
+	if (n) hci_sample_view(hci, &samples[n - 1]);
+	return n;
+}
+
+
+/* take_spare() hands out up to count chars set aside by resynchronizing
+ */
+static int take_spare(packet_rec *pk, byte *buf, int count)
+{
+	int i;
+
+	if (count > pk->num_spare) count = pk->num_spare;
+	for (i = 0; i < count; i++)
+		buf[i] = pk->spare[pk->spare_at++];
+	pk->num_spare -= count;
+	return count;
+}
+
+
+/* keep_spare() sets chars aside, ahead of any already there, to be
+ *   scanned again before more are read from the port.
+ */
+static void keep_spare(packet_rec *pk, byte *buf, int count)
+{
+		/* the chars already there may overlap where they go */
+	memmove(pk->spare + count, pk->spare + pk->spare_at, pk->num_spare);
+	memcpy(pk->spare, buf, count);
+	pk->spare_at = 0;
+	pk->num_spare += count;
+}
+
+
+/* drop_packet() throws away the packet being built, from its cmd byte
+ *   up to (not including) end.
+ */
+static void drop_packet(hci_rec *hci, byte *end)
+{
+	hci->bytes_dropped += 1 + (end - hci->packet.data);
+	hci->packets_dropped++;
+	hci->packet.parsed = 1;
+	hci->packet.num_bytes_needed = 0;
+}
+
 
 /* hci_build_packet() reads chars from serial buffer into the packet array.
  *   Returns false if a valid packet is not yet complete
  *   Returns true when packet-building stops due to completion or an error.
- *   Sets packet.error flag if the cmd_byte is not a valid cmd byte.
- *   Sets num_bytes_expected to -1 if the cmd is not one that the standard
- *     parser (hci_parse_packet()) can deal with.
+ *   Resynchronizes by itself after line noise: chars that cannot be a cmd
+ *     byte are skipped, and a standard packet is thrown away if it holds
+ *     a cmd byte (chars were lost) or is followed by a char that is not
+ *     one (chars were added).  The chars after the bad spot are scanned
+ *     again, so the next good packet is not lost.  Everything thrown
+ *     away is counted in bytes_dropped and packets_dropped.
+ *   A cmd byte that the standard parser (hci_parse_packet()) cannot deal
+ *     with, one that hci_packet_size() gives -1 for, is skipped as noise.
  */
 hci_result hci_build_packet(hci_rec *hci,int checkType)
 {
-	static int      ch;
-	static int      port;
-	int read;
+	int     ch, i, noise;
+	int     port = hci->port_num;
+	int     read;
+	char    cmd;
+	byte    *start;
 
-	port = hci->port_num;
-	if (hci->packet.parsed)
+	for (;;)
 	{
-		if ((ch = host_read_char(port)) == -1)
-		{
-			return NO_PACKET_YET;
-		}
-		else
+		if (hci->packet.parsed)
 		{
-			hci->packet.cmd_byte = (byte) ch;
-			if (ch < 0x80)
-			{
-				hci->packet.error = 1;
-				return SUCCESS;
-			}
-			else
+				/* skip anything that cannot start a packet, including
+				 * config cmds the standard parser cannot deal with */
+			do
 			{
-				hci->packet.parsed = 0;
-				hci->packet.error = 0;
-				hci->packet.data_ptr = hci->packet.data;
-				hci->packet.num_bytes_needed = packet_size(ch);
-				hci->packets_expected--;
-				if (checkType == HCI_CHECK_BGND) {
-					hci_fast_timeout(hci);
-					host_start_timeout(port);
+				if (take_spare(&hci->packet, (byte *) &cmd, 1))
+					ch = (byte) cmd;
+				else if (checkType == HCI_CHECK_FGND)
+				{
+						/* let the driver wait for the cmd byte instead of polling */
+					if (host_read_bytes(port, &cmd, 1, hci->fast_timeout) == 1)
+						ch = (byte) cmd;
+					else
+						ch = -1;
 				}
+				else ch = host_read_char(port);
+
+				if (ch == -1) return NO_PACKET_YET;
+				noise = ch < PACKET_MARKER
+					|| (ch >= CONFIG_MIN && hci_packet_size(ch) < 0);
+				if (noise) hci->bytes_dropped++;
+			} while (noise);
+
+			hci->packet.cmd_byte = (byte) ch;
+			hci->packet.first_usec = host_arrival_usec(port);
+			hci->packet.last_usec = hci->packet.first_usec;
+			hci->packet.parsed = 0;
+			hci->packet.error = 0;
+			hci->packet.data_ptr = hci->packet.data;
+			hci->packet.num_bytes_needed = hci_packet_size(ch);
+			hci->packets_expected--;
+			stats_first_byte(hci);
+			if (checkType == HCI_CHECK_BGND) {
+				hci_fast_timeout(hci);
+				host_start_timeout(port);
 			}
 		}
-	}
 
-	if (!hci->packet.parsed && hci->packet.num_bytes_needed > 0)
-	{
-		if (checkType != HCI_CHECK_FGND)
-		{
-				/* read all the data (up to the packet size) */
-			while ((ch = host_read_char(port)) != -1)
-			{
-				*(hci->packet.data_ptr)++ = ch;
-				if (--hci->packet.num_bytes_needed == 0)
-					break;
-			}
+		if (hci->packet.num_bytes_needed <= 0)
+			return SUCCESS;
 
-				/* see if we go it all */
-			if (hci->packet.num_bytes_needed <= 0)
-				return SUCCESS;
-			else if (checkType == HCI_CHECK_BGND && host_timed_out(port))
-				return TIMED_OUT;
+			/* take all the data that is there (up to the packet size),
+			 * or in the foreground wait for it with a timeout */
+		start = hci->packet.data_ptr;
+		read = take_spare(&hci->packet, start, hci->packet.num_bytes_needed);
+		if (read < hci->packet.num_bytes_needed)
+		{
+			if (checkType != HCI_CHECK_FGND)
+				read += host_read_available(port, (char *) start + read,
+											  hci->packet.num_bytes_needed - read);
 			else
-				return NO_PACKET_YET;
+				read += host_read_bytes(port, (char *) start + read,
+										  hci->packet.num_bytes_needed - read, hci->fast_timeout);
 		}
-		else
-		{
-				/* read with a timeout */
-			read = host_read_bytes(port,(char *) hci->packet.data_ptr,
-										  hci->packet.num_bytes_needed,hci->fast_timeout);
-
-			hci->packet.num_bytes_needed -= read;
-			hci->packet.data_ptr += read;
+		hci->packet.num_bytes_needed -= read;
+		hci->packet.data_ptr += read;
+		if (read) hci->packet.last_usec = host_arrival_usec(port);
 
-			if (hci->packet.num_bytes_needed == 0)
+		if (hci->packet.cmd_byte < CONFIG_MIN)
+		{
+				/* data chars of standard packets never have the top bit set */
+			for (i = 0; i < read && start[i] < PACKET_MARKER; i++)
+				;
+			if (i < read)
 			{
-				return SUCCESS;
+				keep_spare(&hci->packet, start + i, read - i);
+				drop_packet(hci, start + i);
 			}
-			else
+			else if (hci->packet.num_bytes_needed == 0)
 			{
-				return TIMED_OUT;
+					/* peek at the char after it, if the driver already holds one */
+				if (!hci->packet.num_spare && (ch = host_read_buffered(port)) != -1)
+				{
+					cmd = (char) ch;
+					keep_spare(&hci->packet, (byte *) &cmd, 1);
+				}
+				if (hci->packet.num_spare
+					&& hci->packet.spare[hci->packet.spare_at] < PACKET_MARKER)
+					drop_packet(hci, hci->packet.data_ptr);
+			}
+
+			if (hci->packet.parsed)
+			{
+					/* in the foreground, don't wait for a packet that will never come */
+				if (checkType == HCI_CHECK_FGND && hci->packets_expected <= 0
+					&& !hci->packet.num_spare)
+					return TIMED_OUT;
+				continue;
 			}
 		}
-	}
 
-   return SUCCESS;	/* we will never get here */
+			/* see if we got it all */
+		if (hci->packet.num_bytes_needed == 0)
+		{
+			stats_packet(hci);
+			return SUCCESS;
+		}
+		else if (checkType == HCI_CHECK_FGND)
+			return TIMED_OUT;
+		else if (checkType == HCI_CHECK_BGND && host_timed_out(port))
+			return TIMED_OUT;
+		else
+			return NO_PACKET_YET;
+	}
 }
 
 
-/* packet_size() returns the # of data bytes that FOLLOW a given cmd byte
+/* hci_packet_size() returns the # of data bytes that FOLLOW a given cmd byte
  *   The cmd arg is an int, not a byte, for compatibility with host_read_char()
  *   Return val of -1 means packet needs special handling (i.e. passwd)
  *   or has uncertain length; too complicated for standard parser.
+ *   So does a config cmd byte that the HCI does not have.
  */
-int packet_size(int cmd)
+int hci_packet_size(int cmd)
 {
 	int size = 1;   /* Regular cmds always include buttons byte */
-	int bits;
+	std_layout lay;
 
 	if (cmd < CONFIG_MIN)
 	{
-		if (cmd & TIMER_BIT) size += 2;
-		bits = cmd & ANALOG_BITS;
-		if (bits == ANALOG_LO_BIT) size += 2 + 1;
-		else if (bits == ANALOG_HI_BIT) size += 4 + 1;
-		else if (bits == ANALOG_BITS) size += 8 + 1;
-		bits = cmd & ENCODER_BITS;
-		if (bits == ENCODER_LO_BIT) size += 2*5;
-		else if (bits == ENCODER_HI_BIT) size += 2*7;
-		else if (bits == ENCODER_BITS) size += 2*6;
+		memcpy_P(&lay, &std_layouts[cmd & STD_CMD_MASK], sizeof(lay));
+		size = lay.size;
 	}
 	else switch (cmd)
 	{
@@ -928,6 +1278,7 @@ int packet_size(int cmd)
 		case SET_HOME:
 		case SET_HOME_REF:
 		case RESTORE_FACTORY:
+		default:
 			size = -1;
 			break;
 	}
@@ -960,6 +1311,126 @@ void hci_invalidate_fields(hci_rec *hci)
 }
 
 
+/* decode_sample() decodes a complete standard packet into a sample,
+ *   reading each field at the offset its layout fixes.
+ */
+static void decode_sample(packet_rec *pk, hci_sample *s)
+{
+	int cmnd = pk->cmd_byte;
+	byte *data = pk->data;
+	std_layout lay;
+	byte *dp;
+	int bits;
+
+	memcpy_P(&lay, &std_layouts[cmnd & STD_CMD_MASK], sizeof(lay));
+	s->cmd_byte = (byte) cmnd;
+	s->reserved[0] = s->reserved[1] = s->reserved[2] = s->reserved[3] = 0;
+	s->first_usec = pk->first_usec;
+	s->last_usec = pk->last_usec;
+	s->present = lay.present;
+	s->buttons = data[0];
+	s->timer = lay.timer ? (data[1] << 7) + data[2] : 0;
+
+		/* A/D values are 7 MSBs each, then one byte of LSBs */
+	dp = data + 1 + 2 * lay.timer;
+	bits = dp[lay.analogs];
+	switch (lay.analogs)
+	{
+		case 8:
+			s->analog[7] = dp[7] << 1;
+			s->analog[6] = (dp[6] << 1) | (bits & 0x01);
+			s->analog[5] = (dp[5] << 1) | ((bits >> 1) & 1);
+			s->analog[4] = (dp[4] << 1) | ((bits >> 2) & 1);
+			/* fall through */
+		case 4:
+			s->analog[3] = (dp[3] << 1) | ((bits >> 3) & 1);
+			s->analog[2] = (dp[2] << 1) | ((bits >> 4) & 1);
+			/* fall through */
+		case 2:
+			s->analog[1] = (dp[1] << 1) | ((bits >> 5) & 1);
+			s->analog[0] = (dp[0] << 1) | ((bits >> 6) & 1);
+	}
+
+		/* Encoder counts are always the last field */
+	dp = data + lay.size - 2 * lay.encoders;
+	switch (lay.encoders)
+	{
+		case 7:
+			s->encoder[6] = (dp[12] << 7) + dp[13];
+			/* fall through */
+		case 6:
+			s->encoder[5] = (dp[10] << 7) + dp[11];
+			/* fall through */
+		case 5:
+			s->encoder[4] = (dp[8] << 7) + dp[9];
+			s->encoder[3] = (dp[6] << 7) + dp[7];
+			s->encoder[2] = (dp[4] << 7) + dp[5];
+			s->encoder[1] = (dp[2] << 7) + dp[3];
+			s->encoder[0] = (dp[0] << 7) + dp[1];
+	}
+}
+
+
+/* hci_sample_view() copies a sample into the hci_rec fields and sets the
+ *   _updated flags from its presence bits, so code written against the
+ *   hci_rec can look at a sample that was queued or recorded.
+ */
+void hci_sample_view(hci_rec *hci, hci_sample *s)
+{
+	int bits, i;
+
+	bits = s->buttons;
+	hci->buttons = bits;
+	hci->button[0] = bits & 0x01;
+	hci->button[1] = bits & 0x02;
+	hci->button[2] = bits & 0x04;
+	hci->button[3] = bits & 0x08;
+	hci->button[4] = bits & 0x10;
+	hci->button[5] = bits & 0x20;
+	hci->button[6] = bits & 0x40;
+
+	bits = s->present;
+	hci->timer_updated = (bits & SAMPLE_TIMER) != 0;
+	if (hci->timer_updated) hci->timer = s->timer;
+	for (i = 0; i < NUM_ANALOGS; i++)
+		if ((hci->analog_updated[i] = (bits & SAMPLE_ANALOG(i)) != 0))
+			hci->analog[i] = s->analog[i];
+	for (i = 0; i < NUM_ENCODERS; i++)
+		if ((hci->encoder_updated[i] = (bits & SAMPLE_ENCODER(i)) != 0))
+			hci->encoder[i] = s->encoder[i];
+	hci->first_usec = s->first_usec;
+	hci->last_usec = s->last_usec;
+	hci->marker_updated = 0;
+}
+
+
+/* hci_parse_sample() decodes the hci's complete packet straight into the
+ *   caller's *sample (an array slot, a ring buffer entry, ...) without
+ *   touching the hci_rec data fields.  Config packets are parsed into the
+ *   hci_rec as usual and leave *sample alone.
+ *   Returns SUCCESS if *sample was filled in, NO_PACKET_YET if there was
+ *   no complete standard packet.
+ */
+hci_result hci_parse_sample(hci_rec *hci, hci_sample *sample)
+{
+	hci_result result;
+
+	if (hci->packet.parsed || hci->packet.num_bytes_needed > 0)
+		return NO_PACKET_YET;
+
+	if (hci->packet.cmd_byte >= CONFIG_MIN)
+	{
+		if ((result = hci_parse_packet(hci)) != SUCCESS)
+			return hci_error(hci, result);
+		return NO_PACKET_YET;
+	}
+
+	decode_sample(&hci->packet, sample);
+	hci->packet.parsed = 1;
+	return SUCCESS;
+}
+
+
 /* hci_parse_packet() interprets the hci's packet and stores all HCI data
  *   in the HCI record.
  *   Also marks this hci's packet as having been parsed.
@@ -967,10 +1438,9 @@ void hci_invalidate_fields(hci_rec *hci)
  */
 hci_result hci_parse_packet(hci_rec *hci)
 {
-	int cmnd = hci->packet.cmd_byte, bits, temp;
+	int cmnd = hci->packet.cmd_byte;
 	hci_result result = SUCCESS;
-	byte *dp;
-	int *p, *q;
+	hci_sample sample;
 
 	if (hci->packet.num_bytes_needed)
 	{
@@ -983,91 +1453,16 @@ hci_result hci_parse_packet(hci_rec *hci)
 
 	if (result == SUCCESS)
 	{
-		hci_invalidate_fields(hci);
-		dp = hci->packet.data;
 		if (cmnd < CONFIG_MIN)
 		{
-			bits = *dp++;
-			hci->buttons = bits;
-			p = hci->button;
-			*p++ = bits & 0x01;
-			*p++ = bits & 0x02;
-			*p++ = bits & 0x04;
-			*p++ = bits & 0x08;
-			*p++ = bits & 0x10;
-			*p++ = bits & 0x20;
-			*p++ = bits & 0x40;
-			if (cmnd & TIMER_BIT)
-			{
-				temp = *dp++ << 7;
-				temp += *dp++;
-				hci->timer = temp;
-				hci->timer_updated = 1;
-			}
-			bits = (cmnd & ANALOG_BITS) >> 2;
-			if (bits--)
-			{
-				p = hci->analog;
-				q = hci->analog_updated;
-				*p++ = *dp++ << 1;
-				*p++ = *dp++ << 1;
-				*q++ = 1, *q++ = 1;
-				if (bits--)
-				{
-					*p++ = *dp++ << 1;
-					*p++ = *dp++ << 1;
-					*q++ = 1, *q++ = 1;
-					if (bits--)
-					{
-						*p++ = *dp++ << 1;
-						*p++ = *dp++ << 1;
-						*p++ = *dp++ << 1;
-						*p++ = *dp++ << 1;
-						*q++ = 1, *q++ = 1;
-						*q++ = 1, *q++ = 1;
-					}
-				}
-				p = hci->analog;
-				*p++ |= (*dp & 0x40 ? 1 : 0);
-				*p++ |= (*dp & 0x20 ? 1 : 0);
-				*p++ |= (*dp & 0x10 ? 1 : 0);
-				*p++ |= (*dp & 0x08 ? 1 : 0);
-				*p++ |= (*dp & 0x04 ? 1 : 0);
-				*p++ |= (*dp & 0x02 ? 1 : 0);
-				*p++ |= (*dp++ & 0x01 ? 1 : 0);
-			}
-
-			bits = cmnd & ENCODER_BITS;
-			if (bits)
-				{
-				p = hci->encoder;
-				q = hci->encoder_updated;
-				*p = *dp++ << 7;
-				*p++ += *dp++;
-				*p = *dp++ << 7;
-				*p++ += *dp++;
-				*p = *dp++ << 7;
-				*p++ += *dp++;
-				*p = *dp++ << 7;
-				*p++ += *dp++;
-				*p = *dp++ << 7;
-				*p++ += *dp++;
-				*q++ = 1,*q++ = 1;*q++ = 1,*q++ = 1,*q++ = 1;
-				if (bits & ENCODER_HI_BIT)
-					{
-					*p = *dp++ << 7;
-					*p++ += *dp++;
-					*q++ = 1;
-					if (bits==ENCODER_HI_BIT)
-						{
-						*p = *dp++ << 7;
-						*p++ += *dp++;
-						*q++ = 1;
-						}
-					}
-			}
+			decode_sample(&hci->packet, &sample);
+			hci_sample_view(hci, &sample);
+		}
+		else
+		{
+			hci_invalidate_fields(hci);
+			result = hci_parse_cfg_packet(hci);
 		}
-		else result = hci_parse_cfg_packet(hci);
 		hci->packet.parsed = 1;
 	}
 
@@ -1144,32 +1539,52 @@ hci_result hci_parse_cfg_packet(hci_rec *hci)
 }
 
 
+/* string_field() returns the hci_rec field that holds the string asked
+ *    for by a string cmd, or NULL for any other cmd.
+ */
+static char *string_field(hci_rec *hci, int cmnd)
+{
+	switch (cmnd)
+	{
+		case GET_PROD_NAME:     return hci->product_name;
+		case GET_PROD_ID:       return hci->product_id;
+		case GET_MODEL_NAME:    return hci->model_name;
+		case GET_SERNUM:        return hci->serial_number;
+		case GET_COMMENT:       return hci->comment;
+		case GET_PRM_FORMAT:    return hci->param_format;
+		case GET_VERSION:       return hci->version;
+		default:                return NULL;
+	}
+}
+
+
+/* reply_char() waits up to timeout for the next char of a config reply.
+ *    Returns -1 if none comes.
+ */
+static int reply_char(hci_rec *hci, float timeout)
+{
+	char ch;
+
+	if (host_read_bytes(hci->port_num, &ch, 1, timeout) != 1) return -1;
+	return (byte) ch;
+}
+
+
 /* hci_read_string() reads a null-terminated string from the serial port
  *    and stores it in memory pointed to by str
  */
 hci_result hci_read_string(hci_rec *hci, char *str)
 {
 	int port = hci->port_num, ch;
+
 	host_start_timeout(port);
 	while (!host_timed_out(port))
 	{
 		ch=host_read_char(port);
-    if (ch == 0) {
-      Serial.println(" ");
-    }
-    //Serial.print(" "); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 		if (ch != -1)
 		{
-      /*
-      Serial.print(" ("); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-      Serial.print(ch, HEX); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-      Serial.print(")"); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-      Serial.write(ch); //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-      */
 			*str++ = (byte) ch;
-			if  (ch == 0){
-			  return SUCCESS;
-			}
+			if (ch == 0) return SUCCESS;
 		}
 	}
 	return TIMED_OUT;
@@ -1222,45 +1637,39 @@ hci_result hci_read_block(hci_rec *hci, byte *block, int *num_bytes)
 #pragma argsused
 hci_result hci_simple_string(hci_rec *hci, hci_result condition)
 {
-	printf("\n**HCI Error: %s\n", condition);
+	printf("\n**HCI Error: %s\n", hci_result_string(condition));
 
 	return condition;
 }
 
 
+/* hci_result_string() gives the text of an hci_result, for printing.
+ */
+const char *hci_result_string(hci_result result)
+{
+	if ((unsigned) result >= NUM_HCI_RESULTS) return "Unknown HCI result";
+	return result_strings[result];
+}
+
+
 /* hci_error() handles HCI module errors by looking for error handler that
  *   corresponds to the condition.  Uses default_handler if it is NULL.
  *   If default_handler is NULL too, it simply returns the condition.
+ *   Counts every condition in result_count[].
  */
 hci_result hci_error(hci_rec *hci, hci_result condition)
 {
 	hci_result (*handler)(hci_rec*, hci_result);
 
+	hci->result_count[condition]++;
+
 	/* These two are not really errors */
-	if (condition == SUCCESS) return SUCCESS;
-	if (condition == NO_PACKET_YET) return NO_PACKET_YET;
-
-	/* These errors have handler pointers */
-	if (condition == BAD_PORT_NUM)
-		handler = hci->BAD_PORT_handler;
-	else if (condition == CANT_OPEN_PORT)
-		handler = hci->CANT_OPEN_handler;
-	else if (condition == NO_HCI)
-		handler = hci->NO_HCI_handler;
-	else if (condition == CANT_BEGIN)
-		handler = hci->CANT_BEGIN_handler;
-	else if (condition == TIMED_OUT)
-		handler = hci->TIMED_OUT_handler;
-	else if (condition == BAD_PACKET)
-		handler = hci->BAD_PACKET_handler;
-	else if (condition == BAD_PASSWORD)
-		handler = hci->BAD_PASSWORD_handler;
-	else if (condition == BAD_VERSION)
-		handler = hci->BAD_VERSION_handler;
-	else if (condition == BAD_FORMAT)
-		handler = hci->BAD_FORMAT_handler;
-	else handler = NULL;
+	if (condition == SUCCESS || condition == NO_PACKET_YET) return condition;
 
+	if (condition == TIMED_OUT || condition == BAD_PACKET)
+		stats_error(hci, condition);
+
+	handler = hci->handler[condition];
 	if (handler == NULL) handler = hci->default_handler;
 	if (handler == NULL) return condition;
 
@@ -1269,6 +1678,145 @@ hci_result hci_error(hci_rec *hci, hci_result condition)
 
 
 
+/*------------------*/
+/* Link Statistics  */
+/*------------------*/
+
+
+/* hci_keep_stats() makes the hci_rec keep link statistics in room,
+ *   which must stay in place as long as the hci_rec is in use.  They
+ *   start from zero.  Without this call no statistics are kept, which
+ *   spares the RAM they take.
+ */
+void hci_keep_stats(hci_rec *hci, hci_link_stats *room)
+{
+	room->num_sent = room->num_answered = 0;
+	room->answer_timed = 0;
+	hci->link_stats = room;
+	hci_clear_stats(hci);
+}
+
+
+/* hci_get_stats() copies the link statistics of an hci_rec into stats.
+ *   Returns False (zero) if hci_keep_stats() was not called.
+ */
+int hci_get_stats(hci_rec *hci, hci_stats *stats)
+{
+	if (hci->link_stats == NULL)
+		return 0;
+	*stats = hci->link_stats->stats;
+	return 1;
+}
+
+
+/* hci_clear_stats() sets all link statistics back to zero
+ */
+void hci_clear_stats(hci_rec *hci)
+{
+	static const hci_stats no_stats = { 0 };
+	hci_link_stats *ls = hci->link_stats;
+
+	if (ls == NULL)
+		return;
+	ls->stats = no_stats;
+	ls->stats_dropped = hci->bytes_dropped;
+}
+
+
+/* latency_bin() gives the histogram bin of a latency in usec
+ */
+static int latency_bin(unsigned long usec)
+{
+	int bin = 0;
+
+	while (usec && bin < LATENCY_BINS - 1)
+	{
+		usec >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+
+/* stats_request() counts a request of size bytes that has just gone out,
+ *   and notes when, for the latency of its packet.
+ */
+static void stats_request(hci_rec *hci, int size)
+{
+	hci_link_stats *ls = hci->link_stats;
+
+	if (ls == NULL)
+		return;
+	ls->sent_usec[ls->num_sent++ % LATENCY_QUEUE] = host_clock_usec();
+	if (ls->num_sent - ls->num_answered > LATENCY_QUEUE)
+		ls->num_answered = ls->num_sent - LATENCY_QUEUE;
+
+	ls->stats.packets_sent++;
+	ls->stats.bytes_sent += size;
+	ls->stats.queue_depth = hci->packets_expected;
+	if (hci->packets_expected > ls->stats.max_queue_depth)
+		ls->stats.max_queue_depth = hci->packets_expected;
+}
+
+
+/* stats_first_byte() is called when the cmd byte of a packet has come in.
+ *   The packet answers the oldest request in flight, if there is one
+ *   (motion packets are not requested).  Chars the parser dropped since
+ *   the last packet mean it had to resynchronize.
+ */
+static void stats_first_byte(hci_rec *hci)
+{
+	hci_link_stats *ls = hci->link_stats;
+
+	if (ls == NULL)
+		return;
+	ls->answer_timed = (ls->num_answered != ls->num_sent);
+	if (ls->answer_timed)
+	{
+		ls->answer_usec = ls->sent_usec[ls->num_answered++ % LATENCY_QUEUE];
+		ls->stats.first_byte_usec[latency_bin(host_clock_usec() - ls->answer_usec)]++;
+	}
+	if (hci->bytes_dropped != ls->stats_dropped)
+	{
+		ls->stats.resyncs++;
+		ls->stats.bytes_received += hci->bytes_dropped - ls->stats_dropped;
+		ls->stats_dropped = hci->bytes_dropped;
+	}
+	ls->stats.queue_depth = hci->packets_expected > 0 ? hci->packets_expected : 0;
+}
+
+
+/* stats_packet() counts a packet that has come in complete
+ */
+static void stats_packet(hci_rec *hci)
+{
+	hci_link_stats *ls = hci->link_stats;
+
+	if (ls == NULL)
+		return;
+	ls->stats.packets_received++;
+	ls->stats.bytes_received += 1 + (hci->packet.data_ptr - hci->packet.data);
+	if (ls->answer_timed)
+		ls->stats.complete_usec[latency_bin(host_clock_usec() - ls->answer_usec)]++;
+}
+
+
+/* stats_error() counts a TIMED_OUT or BAD_PACKET condition
+ */
+static void stats_error(hci_rec *hci, hci_result condition)
+{
+	hci_link_stats *ls = hci->link_stats;
+
+	if (ls == NULL)
+		return;
+	if (condition == TIMED_OUT)
+		ls->stats.timeouts++;
+	else
+		ls->stats.bad_packets++;
+}
+
+
+
 /*----------------------------*/
 /* Internal Utility Functions */
 /*----------------------------*/
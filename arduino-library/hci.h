@@ -38,31 +38,33 @@
 /* Data Types */
 /*------------*/
 
-/* Use hci_result as if it were an enumerated type.  Compare variables of
- *   this type to the string constants declared below.  An hci_result is
- *   actually a string, so it can be directly printed as well.
+/* hci_result is an enumerated type.  Compare variables of this type to
+ *   the constants below; SUCCESS is zero.  Use hci_result_string() to
+ *   print one.  The codes also index the handler[] and result_count[]
+ *   tables of an hci_rec.
  */
-typedef char*   hci_result;
-
 #ifdef __WIN32__
 #ifdef TRY_AGAIN[]
 #undef TRY_AGAIN
 #endif /* TRY_AGAIN */
 #endif /* __WIN32__ */
 
-/* Constants for hci_result variables */
-extern char     BAD_PORT_NUM[]; /* Port number not valid */
-extern char     CANT_OPEN_PORT[];       /* Can't open the port during start-up */
-extern char     NO_HCI[];       /* No response from HCI during start-up */
-extern char     CANT_BEGIN[];   /* No response to "BEGIN" at start of session */
-extern char     NO_PACKET_YET[];        /* Complete packet not yet recv'd */
-extern char     TIMED_OUT[];    /* Didn't get complete packet in time */
-extern char     BAD_PACKET[];   /* Received packet that did not make sense */
-extern char     BAD_PASSWORD[]; /* Cfg cmd requiring passwd was denied */
-extern char     SUCCESS[];      /* Successful operation */
-extern char     TRY_AGAIN[];    /* Try the operation again */
-extern char     BAD_VERSION[];  /* Feature isn't supported by firmware */
-extern char     BAD_FORMAT[];   /* Parameter block is in unreadable format */
+typedef enum
+{
+	SUCCESS,        /* Successful operation */
+	NO_PACKET_YET,  /* Complete packet not yet recv'd */
+	TRY_AGAIN,      /* Try the operation again */
+	TIMED_OUT,      /* Didn't get complete packet in time */
+	BAD_PORT_NUM,   /* Port number not valid */
+	BAD_PACKET,     /* Received packet that did not make sense */
+	NO_HCI,         /* No response from HCI during start-up */
+	CANT_BEGIN,     /* No response to "BEGIN" at start of session */
+	CANT_OPEN_PORT, /* Can't open the port during start-up */
+	BAD_PASSWORD,   /* Cfg cmd requiring passwd was denied */
+	BAD_VERSION,    /* Feature isn't supported by firmware */
+	BAD_FORMAT,     /* Parameter block is in unreadable format */
+	NUM_HCI_RESULTS /* # of result codes, not a result itself */
+} hci_result;
 
 /* Shorthand for a byte */
 typedef unsigned char   byte;
@@ -91,9 +93,89 @@ typedef struct
 	byte    cmd_byte;
 	byte    data[MAX_PACKET_SIZE];
 	byte    *data_ptr;
+	byte    spare[MAX_PACKET_SIZE];   /* chars to scan again after resynch */
+	int     spare_at;
+	int     num_spare;
+	unsigned long long first_usec;  /* arrival of the cmd byte */
+	unsigned long long last_usec;   /* arrival of the last data byte */
 } packet_rec;
 
 
+/* Record for the data of one standard packet: the unit for recording,
+ *   queuing and batch processing.  Plain data of a fixed 48 bytes with no
+ *   padding, so hci_parse_sample() can write it straight into an array
+ *   or a ring buffer and it can be saved to a file as it is.
+ *   Bits in 'present' tell which fields hold data; buttons always do.
+ *   first_usec and last_usec tell when the host received the first and
+ *   last byte of the packet, on the host_arrival_usec() clock
+ *   (CLOCK_MONOTONIC on Linux), so the age of a sample is known.
+ *   On the Arduino they are the time of the read, from the 32-bit
+ *   micros(), and wrap around at 2^32 usec.
+ *   hci_sample_view() copies one into the hci_rec fields.
+ */
+typedef struct
+{
+	unsigned short  present;        /* SAMPLE_ bits below */
+	unsigned short  timer;
+	unsigned short  encoder [NUM_ENCODERS];
+	byte            analog [NUM_ANALOGS];
+	byte            buttons;        /* button bits all together */
+	byte            cmd_byte;       /* cmd byte of the packet */
+	byte            reserved [4];   /* keeps the times 8-byte aligned */
+	unsigned long long first_usec;  /* arrival of the cmd byte */
+	unsigned long long last_usec;   /* arrival of the last data byte */
+} hci_sample;
+
+#define SAMPLE_ENCODER(i)   (1u << (i))         /* bits 0-6 */
+#define SAMPLE_ANALOG(i)    (0x80u << (i))      /* bits 7-14 */
+#define SAMPLE_TIMER        0x8000u
+
+
+/* # of bins in each latency histogram.  Bin i counts latencies of
+ *   2^(i-1) up to 2^i usec, bin 0 counts zero, and the last bin counts
+ *   everything longer as well. */
+#define LATENCY_BINS    24
+
+/* # of requests in flight whose send times are kept for the histograms */
+#define LATENCY_QUEUE   16
+
+/* Record of link statistics, see hci_get_stats().
+ *   Counts the requests and packets that go through the packet parser
+ *   (hci_std_cmd(), hci_simple_cfg_cmd(), hci_insert_marker() and
+ *   hci_build_packet()), not the exchanges made while connecting.
+ */
+typedef struct
+{
+	unsigned long   packets_sent;   /* requests issued */
+	unsigned long   packets_received; /* complete packets */
+	unsigned long   bytes_sent;
+	unsigned long   bytes_received; /* line noise included */
+	unsigned long   timeouts;       /* TIMED_OUT passed to hci_error() */
+	unsigned long   bad_packets;    /* BAD_PACKET passed to hci_error() */
+	unsigned long   resyncs;        /* times the parser found its place again */
+	int             queue_depth;    /* packets_expected, as last seen */
+	int             max_queue_depth;
+	unsigned long   first_byte_usec [LATENCY_BINS]; /* request to cmd byte */
+	unsigned long   complete_usec [LATENCY_BINS];   /* request to whole packet */
+} hci_stats;
+
+
+/* Room for the link statistics of one hci_rec, see hci_keep_stats().
+ *   The send times of requests in flight are kept in sent_usec[]
+ *   until their packets arrive.
+ */
+typedef struct
+{
+	hci_stats       stats;
+	unsigned long   sent_usec [LATENCY_QUEUE];
+	unsigned long   num_sent;       /* requests timed so far */
+	unsigned long   num_answered;   /* of those, how many have been answered */
+	unsigned long   answer_usec;    /* send time of the packet being built */
+	int             answer_timed;   /* answer_usec is valid */
+	long int        stats_dropped;  /* bytes_dropped already in stats */
+} hci_link_stats;
+
+
 /* Record containing all HCI data
  *   Declare one of these structs for each Immersion HCI in use.
  *   The hci_connect() command will establish communication with an Immersion
@@ -112,6 +194,10 @@ typedef struct hci_rec
 	float           fast_timeout;   /* Timeout period for fast process */
 	packet_rec      packet;         /* The current packet */
 	int             packets_expected; /* Determines whether timeout is important */
+	long int        bytes_dropped;  /* Line noise skipped by the packet parser */
+	long int        packets_dropped;  /* Corrupted packets it threw away */
+	long int        signon_baud;    /* Rate the Arm was found at by autosynch */
+	unsigned long   signon_usec;    /* Time the last autosynch took */
 
 	/* Marker field lets you mark different segments of data in incoming
 	 *   buffer.  hci_insert_marker() makes HCI insert a marker into the
@@ -130,6 +216,11 @@ typedef struct hci_rec
 	int     analog [NUM_ANALOGS];   /* A/D channels */
 	int     encoder [NUM_ENCODERS]; /* Encoder counts */
 
+	/* Arrival of the first and last byte of the packet the fields above
+	 *   came from, as in hci_sample */
+	unsigned long long first_usec;
+	unsigned long long last_usec;
+
 	/* Normalization values for primary quantities:
 	 *   These values give some reference or normalization quantity
 	 *     for each field.
@@ -189,16 +280,10 @@ typedef struct hci_rec
 	 * See programmer's guide for more discussion.
 	 */
 
-	/* Handlers for errors */
-	hci_result      (*BAD_PORT_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*CANT_OPEN_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*NO_HCI_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*CANT_BEGIN_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*TIMED_OUT_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*BAD_PACKET_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*BAD_PASSWORD_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*BAD_VERSION_handler)(struct hci_rec *hci, hci_result condition);
-	hci_result      (*BAD_FORMAT_handler)(struct hci_rec *hci, hci_result condition);
+	/* Handlers for errors, indexed by condition,
+	 *   e.g. hci.handler[TIMED_OUT] = my_handler;
+	 *   The SUCCESS and NO_PACKET_YET entries are never used. */
+	hci_result      (*handler[NUM_HCI_RESULTS])(struct hci_rec *hci, hci_result condition);
 
 	/* Handler to use for an error if everything above is NULL
 	 * The simplest way to get diagnostic reporting is to
@@ -208,7 +293,14 @@ typedef struct hci_rec
 	 * the appropriate o.s. calls in the function pointed to by
 	 * this handler pointer.
 	 */
-	hci_result      (*default_handler)();
+	hci_result      (*default_handler)(struct hci_rec *hci, hci_result condition);
+
+	/* Number of times each condition has gone through hci_error(),
+	 *   indexed by condition */
+	long int        result_count[NUM_HCI_RESULTS];
+
+	/* Link statistics, NULL unless hci_keep_stats() gave them room */
+	hci_link_stats  *link_stats;
 
 	/* Extra field available for user's application-specific purpose */
 	long int        user_data;
@@ -271,8 +363,15 @@ typedef struct hci_rec
 /* A timeout period is the time to transmit this many chars */
 #define TIMEOUT_CHARS   2*MAX_PACKET_SIZE
 
-/* Time (sec) to wait between signon attempts in 'connect' process */
-#define SIGNON_PAUSE    15e-3
+/* Time (sec) allowed for the Arm to start echoing a signon attempt,
+ *   on top of the time to send it and read the echo */
+#define SIGNON_WAIT     5e-3
+
+/* Chars sent and echoed in a signon attempt: END_SESSION, then SIGNON_STR */
+#define SIGNON_CHARS    9
+
+/* Most chars to scan for the echo before making another signon attempt */
+#define SIGNON_SCAN     64
 
 /* Time (sec) to wait after ending session */
 #define END_PAUSE       15e-3
@@ -283,6 +382,15 @@ typedef struct hci_rec
 /* Time (sec) to wait after restoring factory settings */
 #define RESTORE_PAUSE   2.0
 
+/* Rate every HCI and cable can sign on at */
+#define SAFE_BAUD       9600L
+
+/* # of test packets that must arrive intact before a baud rate is kept */
+#define UPGRADE_BURST   32
+
+/* # of test requests in flight during hci_verify_link() */
+#define VERIFY_DEPTH    4
+
 /* Code sent by HCI to accept a password */
 #define PASSWD_OK       0xFF
 
@@ -297,7 +405,10 @@ void            hci_init(hci_rec *hci, int port, long int baud);
 hci_result      hci_connect(hci_rec *hci);
 void            hci_disconnect(hci_rec *hci);
 hci_result      hci_get_strings(hci_rec *hci);
+hci_result      hci_get_constants(hci_rec *hci, byte *block, int *block_size);
 void            hci_change_baud(hci_rec *hci, long int new_baud);
+hci_result      hci_verify_link(hci_rec *hci, int burst);
+hci_result      hci_upgrade_baud(hci_rec *hci, long int max_baud, int burst);
 void            hci_reset_com(hci_rec *hci);
 hci_result      hci_autosynch(hci_rec *hci);
 hci_result      hci_begin(hci_rec *hci);
@@ -335,11 +446,14 @@ float   hci_version_num(hci_rec *hci);
 hci_result      hci_wait_packet(hci_rec *hci);
 hci_result      hci_check_packet(hci_rec *hci,int checkType);
 hci_result      hci_check_motion(hci_rec *hci);
+int             hci_read_motion(hci_rec *hci, hci_sample *samples, int max);
 hci_result      hci_build_packet(hci_rec *hci,int checkTYpe);
 
 /* Packet parsing functions */
 hci_result      hci_parse_packet(hci_rec *hci);
 hci_result      hci_parse_cfg_packet(hci_rec *hci);
+hci_result      hci_parse_sample(hci_rec *hci, hci_sample *sample);
+void            hci_sample_view(hci_rec *hci, hci_sample *sample);
 int             hci_packet_size(int cmd);
 
 /* Helper functions */
@@ -352,6 +466,12 @@ int             hci_strcmp(char *s1, char *s2);
 /* Error handling */
 hci_result      hci_error(hci_rec *hci, hci_result condition);
 hci_result      hci_simple_string(hci_rec *hci, hci_result condition);
+const char     *hci_result_string(hci_result result);
+
+/* Link statistics */
+void            hci_keep_stats(hci_rec *hci, hci_link_stats *room);
+int             hci_get_stats(hci_rec *hci, hci_stats *stats);
+void            hci_clear_stats(hci_rec *hci);
 
 /* Conversion between baud rates and 6811 BAUD register codes */
 byte            baud_to_code(long int baud);
@@ -34,6 +34,17 @@
 
 #define PI              3.1415926535898
 
+/* Max # of requests a stream keeps queued at the HCI */
+#define MAX_STREAM_DEPTH	8
+
+/* Trig tables (see arm_use_trig_tables()): a quarter turn of encoder
+ *   counts is split into at most 2^TRIG_COARSE_BITS coarse steps of at
+ *   most 2^TRIG_FINE_BITS fine steps each, enough for the HCI's 14-bit
+ *   encoder counts.  One table is shared by all joints with the same
+ *   encoder resolution. */
+#define TRIG_COARSE_BITS	6
+#define TRIG_FINE_BITS		6
+
 #define RIGHT_PEDAL	1
 #define LEFT_PEDAL	2
 #define BOTH_PEDALS	3
@@ -54,6 +65,8 @@ typedef float   length;
 typedef float   angle;
 typedef float   ratio;
 typedef float   matrix_4[4][4];
+typedef float   affine_3x4[3][4];   /* top rows of a matrix_4 whose
+										bottom row is {0,0,0,1} */
 
 /* General 3D spatial coordinate data type */
 typedef struct
@@ -100,6 +113,50 @@ extern char     XYZ_EULER[];
 extern char     ZXY_EULER[];
 
 
+/* Sines and cosines of all counts of one encoder resolution.
+ *   A count is split into a quarter turn, a coarse step and a fine step;
+ *   the last two are put together with the angle-sum formulas.
+ *   Built by arm_get_constants() after arm_use_trig_tables().
+ */
+typedef struct
+{
+	unsigned        counts;         /* Encoder counts per turn, 0 = unused */
+	int             quarter_bits;   /* log2 of counts per quarter turn */
+	int             fine_bits;      /* log2 of counts per coarse step */
+	int             num_coarse;     /* Coarse steps per quarter turn */
+	ratio           coarse_sn [(1 << TRIG_COARSE_BITS) + 1];
+	ratio           fine_sn [1 << TRIG_FINE_BITS];
+	ratio           fine_cs [1 << TRIG_FINE_BITS];
+} trig_table;
+
+
+/* Calibration cache record
+ *   Everything arm_get_constants() downloads from the Arm, as saved by
+ *   arm_save_cache() under the Arm's serial number.  The derived constants
+ *   are not saved: they depend on the length units and MSTIP.DAT, and are
+ *   recomputed on every connect.
+ */
+typedef struct
+{
+	int     size;           /* sizeof(arm_cache_rec), catches stale layouts */
+	char    serial_number [MAX_STRING_SIZE];
+	char    version [MAX_STRING_SIZE];
+	char    product_name [MAX_STRING_SIZE];
+	char    product_id [MAX_STRING_SIZE];
+	char    model_name [MAX_STRING_SIZE];
+	char    comment [MAX_STRING_SIZE];
+	char    param_format [MAX_STRING_SIZE];
+	int     button_supported [NUM_BUTTONS];
+	int     max_timer;
+	int     max_analog [NUM_ANALOGS];
+	int     max_encoder [NUM_ENCODERS];
+	byte    param_block[PARAM_BLOCK_SIZE];
+	int     p_block_size;
+	byte    ext_param_block[EXT_PARAM_BLOCK_SIZE];
+	int     ext_p_block_size;
+} arm_cache_rec;
+
+
 /* Record containing all Arm data
  *   Declare one of these structs for each Arm in use.
  *   Each arm_rec must be init'ed with arm_init() before use.
@@ -165,8 +222,10 @@ typedef struct arm_rec
 	ratio   JOINT_DEGREES_FACTOR[NUM_DOF]; /* Factors to multiply by
 			encoder counts in order to get angles in degrees */
 
-	/* Intermediate matrix products */
-	matrix_4        M[NUM_DOF];
+	/* Matrix of each link.  Not kept up to date with each packet:
+	 *   arm_calc_T() does without them, so they are computed on demand
+	 *   by arm_calc_M() and are stale until it is called. */
+	affine_3x4      M[NUM_DOF];
 
 	/* Trigonometric quantities: */
 	ratio           cs[NUM_DOF]; /* cosines of all angles */
@@ -174,6 +233,22 @@ typedef struct arm_rec
 	ratio           csALPHA[NUM_DOF];       /* cs & sn of ALPHA const's */
 	ratio           snALPHA[NUM_DOF];
 
+	/* Skew of joint 2's axis, by ALPHA about x and BETA about y.
+	 *   The other joints are skewed by ALPHA only, which csALPHA and
+	 *   snALPHA describe.  Built by arm_calc_params(). */
+	ratio           skew[3][3];
+
+	/* Table each joint's cs & sn are looked up in, NULL = use sin() & cos() */
+	trig_table      *joint_trig[NUM_DOF];
+
+	/* What the last calculation left, so the next can skip joints
+	 *   that have not moved (see arm_recalc_all()) */
+	int             trig_count[NUM_DOF];    /* Encoder counts cs & sn are
+			for, -1 = none */
+	int             first_moved;    /* First joint whose frame is stale */
+	affine_3x4      frame[NUM_DOF - 1];     /* Top rows of T as it was
+			after each joint but the last */
+
    /*---------------------------
     * Internal status variables:
     *   Do not access directly.  Use functions provided to manipulate these.
@@ -182,12 +257,23 @@ typedef struct arm_rec
 	int             timer_report;   /* Flag telling whether to report timer */
 	int             anlg_reports;   /* # of analog values to report */
 
+	/* Flag telling arm_get_constants() to use the calibration cache */
+	int             use_cache;
+
+	/* Storage arm_get_constants() sets up trig tables in, NULL = none */
+	trig_table      *trig_tables;
+	int             num_trig_tables;
+
 	/* Number of points needed in next endpoint calculation */
 	int             num_points;
 
 	/* Calculation function to execute after getting next packet */
 	void            (*packet_calc_fn)(struct arm_rec*);
 
+	/* Requests kept in flight by the 'streaming' method, 0 = not streaming */
+	int             stream_depth;
+	int             stream_encoders;        /* # encoders in each request */
+
    /*----------------
     * Low-level data:
     */
@@ -236,6 +322,7 @@ void            arm_init(arm_rec *arm);
 
 /* Communications */
 arm_result      arm_connect(arm_rec *arm, int port, long int baud);
+arm_result      arm_connect_fastest(arm_rec *arm, int port, long int max_baud);
 void            arm_disconnect(arm_rec *arm);
 void            arm_change_baud(arm_rec *arm, long int new_baud);
 
@@ -286,6 +373,8 @@ void            arm_full_bckg(arm_rec *arm);
  *     or a button is pressed. */
 	/* Checking for incoming 'motion-sensing' data */
 arm_result      arm_check_motion(arm_rec *arm);
+	/* Taking all 'motion-sensing' data that has come in at once */
+int             arm_read_motion(arm_rec *arm, hci_sample *samples, int max);
 	/* Canceling motion-sensing mode */
 void            arm_end_motion(arm_rec *arm);
 	/* Stylus coordinates */
@@ -303,6 +392,22 @@ void            arm_full_motion(arm_rec *arm, int motion_thresh,
 			int packet_delay, int btns_active);
 
 
+/* Getting data using 'streaming' method
+ *   Several requests are kept in flight; each packet triggers the next */
+	/* Waiting for the next streamed packet */
+arm_result      arm_check_stream(arm_rec *arm);
+	/* Stopping the stream */
+void            arm_end_stream(arm_rec *arm);
+	/* Stylus coordinates */
+void            arm_stylus_6DOF_stream(arm_rec *arm, int depth);
+void            arm_stylus_3DOF_stream(arm_rec *arm, int depth);
+	/* Joint angles ONLY */
+void            arm_3joint_stream(arm_rec *arm, int depth);
+void            arm_6joint_stream(arm_rec *arm, int depth);
+	/* All Arm data */
+void            arm_full_stream(arm_rec *arm, int depth);
+
+
 
 /*---------------------------*/
 /* Setting Modes and Options */
@@ -322,6 +427,19 @@ void            arm_skip_timer(arm_rec *arm);
 void            arm_report_analog(arm_rec *arm, int analog_reports);
 void            arm_skip_analog(arm_rec *arm);
 
+/* Caching the Arm's constants between sessions
+ *   Default is to download them on every connect,
+ *   unless arm_use_cache() is used */
+void            arm_use_cache(arm_rec *arm);
+void            arm_skip_cache(arm_rec *arm);
+
+/* Looking up joint sines & cosines in tables
+ *   Default is to call sin() and cos(),
+ *   unless arm_use_trig_tables() is used */
+void            arm_use_trig_tables(arm_rec *arm, trig_table *tables,
+									int num_tables);
+void            arm_skip_trig_tables(arm_rec *arm);
+
 
 /*-------------*/
 /* Calculation */
@@ -339,10 +457,13 @@ void    arm_calc_nothing(arm_rec *arm);
 /*---------------------*/
 void    arm_calc_T(arm_rec *arm);
 void    arm_calc_M(arm_rec *arm);
+void    arm_recalc_all(arm_rec *arm);
 void    arm_calc_stylus_dir(arm_rec *arm);
 void    arm_mul_4x4(matrix_4 M1, matrix_4 M2, matrix_4 X);
 void    arm_identity_4x4(matrix_4 M);
 void    arm_assign_4x4(matrix_4 to, matrix_4 from);
+void    arm_expand_3x4(matrix_4 to, affine_3x4 from);
+void    arm_assign_3x4(affine_3x4 to, affine_3x4 from);
 
 
 /*---------------*/
@@ -357,7 +478,10 @@ arm_result      arm_home_pos(arm_rec *arm);
 arm_result      arm_convert_params(arm_rec *arm);
 arm_result		 arm_convert_ext_params(arm_rec *arm);
 int             arm_params_DH0_5(arm_rec *arm);
+int             arm_load_cache(arm_rec *arm);
+void            arm_save_cache(arm_rec *arm);
 void            arm_calc_params(arm_rec *arm);
+void            arm_calc_trig_tables(arm_rec *arm);
 
 
 /*-------------------------------*/
@@ -379,6 +503,7 @@ void            arm_install_simple(arm_rec *arm);
 arm_result      arm_get_constants(arm_rec *arm);
 void            arm_start_motion(arm_rec *arm, int num_encoders,
 			int motion_thresh, int packet_delay, int btns_active);
+void            arm_start_stream(arm_rec *arm, int num_encoders, int depth);
 
 
 #endif /* arm_h */
@@ -9,56 +9,186 @@
 
 #include <Bela.h>
 #include <libraries/Serial/Serial.h> // Dev branch at the moment including function available()
-#include <sys/time.h>
+#include <time.h>
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <linux/serial.h>
+#include <thread>
 
 extern "C" {
 	#include "drive.h"
 }
 
-struct timeval time_now;
+#define NUM_PORTS 4
+#define RING_SIZE 4096		/* reader thread ring, a power of two */
+#define RING_MASK (RING_SIZE - 1)
+#define READER_WAIT 250e-6	/* polling slice (sec) while waiting on the ring */
+
 const int maxLen = 128;
-unsigned long timeout_start;
 
-Serial gSerial;
+/* Timeout length and deadline of each port, in usec on CLOCK_MONOTONIC */
+unsigned long long timeout_usec[NUM_PORTS];
+unsigned long long deadline_usec[NUM_PORTS];
+
+#ifdef XENOMAI_SKIN_posix
+/* Cobalt's clock_nanosleep(), an RT sleep that does not switch a Xenomai
+   thread to secondary mode.  Plain Linux threads get EPERM from it.
+   The __real_ calls are glibc's, which the wrapped names no longer reach. */
+extern "C" int __wrap_clock_nanosleep(clockid_t clock_id, int flags,
+	const struct timespec *request, struct timespec *remain);
+extern "C" int __real_clock_nanosleep(clockid_t clock_id, int flags,
+	const struct timespec *request, struct timespec *remain);
+extern "C" int __real_clock_gettime(clockid_t clock_id, struct timespec *tp);
+#endif
+
+/* One Serial per port, each with its own fd */
+Serial gSerial[NUM_PORTS];
+
+/* Device files behind port numbers 0..NUM_PORTS-1.  Port 0 is UART4 on
+   the SERIAL header; use host_set_device() to point a port elsewhere. */
+const char *port_dev[NUM_PORTS] = {
+	"/dev/ttyS4", "/dev/ttyS5", "/dev/ttyUSB0", "/dev/ttyUSB1"
+};
+
+/* Bytes already read from gSerial but not yet handed out */
+char rx_buffer[NUM_PORTS][maxLen];
+int rx_head[NUM_PORTS];	/* chars come in here */
+int rx_tail[NUM_PORTS];	/* chars are read out here */
+unsigned long long rx_stamp[NUM_PORTS];	/* time of the last read, usec */
+int port_open[NUM_PORTS];
+
+/* Optional reader thread of a port (see host_start_reader()).
+   The ring is single-producer/single-consumer: only the reader thread
+   moves head, only the application moves tail.  The reader is a plain
+   Linux thread, so its read() calls never touch a Xenomai task. */
+struct reader_rec {
+	std::thread thread;
+	int wanted;		/* keep a reader on this port across reopens */
+	int priority;		/* SCHED_FIFO priority, 0 = normal scheduling */
+	int running;
+	unsigned head;		/* next free slot */
+	unsigned tail;		/* next char to hand out */
+	char buf[RING_SIZE];
+	unsigned long long stamp[RING_SIZE];	/* arrival of each char, usec */
+};
+
+reader_rec reader[NUM_PORTS];
+
+/* Arrival time of the last char handed out by the read functions */
+unsigned long long last_arrival[NUM_PORTS];
+
+/* Low-latency profile of a port (see host_set_low_latency()).
+   The old_ values are put back by host_close_serial(); -1 = untouched. */
+struct latency_rec {
+	int wanted;		/* apply the profile whenever the port opens */
+	int old_flags;		/* serial_struct flags */
+	int old_rx_trigger;	/* UART rx FIFO trigger level, bytes */
+	int old_latency_timer;	/* USB serial latency timer, ms */
+};
+
+latency_rec latency[NUM_PORTS];
+
+#define RX_TRIGGER_ATTR "rx_trig_bytes"
+#define LATENCY_TIMER_ATTR "device/latency_timer"
 
 /*------------------*/
 /* Timing Functions */
 /*------------------*/
 
+//   A D D _ D E L A Y
+// add_delay() moves a timespec delay_sec seconds later
+static void add_delay(struct timespec *t, float delay_sec) {
+	t->tv_sec += (time_t) delay_sec;
+	t->tv_nsec += (long) ((delay_sec - (time_t) delay_sec) * 1e9);
+	if (t->tv_nsec >= 1000000000L) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000L;
+	}
+}
+
+
 //   H O S T _ P A U S E
 // host_pause() pauses for the given number of seconds
+// Sleeps until an absolute deadline on CLOCK_MONOTONIC: sleep() used to
+// truncate the 15 ms pauses to nothing.
 void host_pause(float delay_sec) {
+	struct timespec deadline;
+	int ret;
+
+	if (delay_sec <= 0) return;
+
+#ifdef XENOMAI_SKIN_posix
+	clock_gettime(CLOCK_MONOTONIC, &deadline);	/* Cobalt's clock */
+	add_delay(&deadline, delay_sec);
+	do {
+		ret = __wrap_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	} while (ret == EINTR);
+	if (ret != EPERM) return;
+
+	/* Not a Xenomai thread: sleep on the Linux clock instead */
+	__real_clock_gettime(CLOCK_MONOTONIC, &deadline);
+	add_delay(&deadline, delay_sec);
+	do {
+		ret = __real_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	} while (ret == EINTR);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	add_delay(&deadline, delay_sec);
+	do {
+		ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	} while (ret == EINTR);
+#endif
+}
 
-	sleep(delay_sec);
 
+//   N O W _ U S E C
+// now_usec() returns the monotonic clock in microseconds
+static unsigned long long now_usec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+//   H O S T _ C L O C K _ U S E C
+// host_clock_usec() reads a free-running microsecond clock for timing
+// intervals.  It wraps around, so only unsigned differences are meaningful.
+unsigned long host_clock_usec(void) {
+	return (unsigned long) now_usec();
 }
 
 
 //   H O S T _ G E T _ T I M E O U T
 // host_get_timeout() gets the timeout period of the given port in seconds
 float   host_get_timeout(int port) {
-  return 1;
-  // can't see this function being called anywhere
+  return timeout_usec[port] * 1e-6;
 }
 
 //   H O S T _ S E T _ T I M E O U T
 // host_set_timeout() sets the length of all future timeout periods to the given # of seconds
 void host_set_timeout(int port, float timeout_sec) {
-  //SerialArm.setTimeout(timeout_sec * 1000);
-  // blank
-  //gSerial.setTimeout(timeout_sec);
-  //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< FIX?
+  if (timeout_sec < 0) timeout_sec = 0;
+  timeout_usec[port] = (unsigned long long) (timeout_sec * 1e6);
 }
 
 
 //   H O S T _ S T A R T _ T I M E O U T
 // host_start_timeout() starts a timer for the specified port.
-// Call timed_out_yet() to find out whether time is up.
+// Call host_timed_out() to find out whether time is up.
 void host_start_timeout(int port) {
-  //timeout_start = millis();
-  timeout_start = gettimeofday(&time_now, NULL);
-  //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+  deadline_usec[port] = now_usec() + timeout_usec[port];
 }
 
 
@@ -66,8 +196,204 @@ void host_start_timeout(int port) {
 // host_timed_out() returns True if the previously-started timeout
 // period is over.  Returns False if not.
 int host_timed_out(int port) {
-  return ((gettimeofday(&time_now, NULL) - timeout_start) > 3);
-  //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+  return (now_usec() >= deadline_usec[port]);
+}
+
+
+//   M S E C _ L E F T
+// msec_left() returns the time left until the port's deadline, rounded
+// up to whole milliseconds for gSerial.read().  Zero once it has passed.
+static int msec_left(int port) {
+	unsigned long long now = now_usec();
+
+	if (now >= deadline_usec[port]) return 0;
+	return (int) ((deadline_usec[port] - now + 999) / 1000);
+}
+
+
+//   P R O F I L E _ F D
+// profile_fd() opens a second fd on the port's tty for the reader's poll()
+// and the ioctls of the low-latency profile; gSerial keeps its own fd to
+// itself.  Close the result after use.
+static int profile_fd(int port) {
+	return open(port_dev[port], O_RDWR | O_NOCTTY | O_NONBLOCK);
+}
+
+
+/*---------------*/
+/* Reader Thread */
+/*---------------*/
+
+//   R E A D E R _ O N
+// reader_on() returns True if a reader thread owns the port's input
+static int reader_on(int port) {
+	return __atomic_load_n(&reader[port].running, __ATOMIC_ACQUIRE);
+}
+
+
+//   R I N G _ C O U N T
+// ring_count() returns the # of chars waiting in the port's ring
+static unsigned ring_count(int port) {
+	return __atomic_load_n(&reader[port].head, __ATOMIC_ACQUIRE) - reader[port].tail;
+}
+
+
+//   R I N G _ T A K E
+// ring_take() moves up to max chars out of the port's ring into buf.
+// Returns # of chars moved.
+static int ring_take(int port, char *buf, int max) {
+	reader_rec *r = &reader[port];
+	unsigned tail = r->tail;
+	unsigned n = ring_count(port);
+	unsigned first;
+
+	if (n > (unsigned) max) n = max;
+	if (n == 0) return 0;
+	first = RING_SIZE - (tail & RING_MASK);
+	if (first > n) first = n;
+	memcpy(buf, r->buf + (tail & RING_MASK), first);
+	memcpy(buf + first, r->buf, n - first);
+	last_arrival[port] = r->stamp[(tail + n - 1) & RING_MASK];
+	__atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+
+//   R E A D E R _ T H R E A D
+// reader_thread() owns the input of one port: it waits in poll() on a
+// second fd of the tty, since gSerial keeps its own to itself, and moves
+// every char that arrives into the ring with its arrival time.
+// On a hangup or an error other than EINTR it stops by itself, and the
+// port goes back to direct reads.  Chars left in the ring are discarded.
+static void reader_thread(int port) {
+	reader_rec *r = &reader[port];
+	struct sched_param param;
+	struct pollfd pfd;
+	unsigned head, space, chunk, i;
+	unsigned long long now;
+	int got;
+
+	if (r->priority > 0) {
+		/* raw syscall, so Xenomai's wrappers can't turn this into an RT task */
+		param.sched_priority = r->priority;
+		syscall(SYS_sched_setscheduler, 0, SCHED_FIFO, &param);
+	}
+
+	pfd.fd = profile_fd(port);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0) {
+		__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+		return;
+	}
+	while (__atomic_load_n(&r->running, __ATOMIC_ACQUIRE)) {
+		head = r->head;
+		space = RING_SIZE - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+		if (space == 0) {
+			usleep(1000);	/* application is behind, let the tty hold it */
+			continue;
+		}
+		chunk = RING_SIZE - (head & RING_MASK);
+		if (chunk > space) chunk = space;
+
+		got = poll(&pfd, 1, 50);	/* wake up now and then to see if we should stop */
+		if (got == 0 || (got < 0 && errno == EINTR)) continue;
+		if (got < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) break;
+
+		got = gSerial[port].read(r->buf + (head & RING_MASK), chunk, 0);
+		if (got == 0 || (got < 0 && errno == EINTR)) continue;
+		if (got < 0) break;
+
+		now = now_usec();
+		for (i = 0; i < (unsigned) got; i++) {
+			r->stamp[(head + i) & RING_MASK] = now;
+		}
+		__atomic_store_n(&r->head, head + got, __ATOMIC_RELEASE);
+	}
+	close(pfd.fd);
+	__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+}
+
+
+//   R E A D E R _ H A L T
+// reader_halt() stops the reader thread of a port, if it has one, or
+// joins one that has stopped by itself.
+// Chars still in the ring are discarded.
+static void reader_halt(int port) {
+	reader_rec *r = &reader[port];
+
+	if (!r->thread.joinable()) return;
+	__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+	r->thread.join();
+	r->head = r->tail = 0;
+}
+
+
+//   R E A D E R _ L A U N C H
+// reader_launch() starts the reader thread of an open port.  Chars that
+// were already buffered are moved to the ring first.
+// Returns False (zero) if the thread could not be started.
+static int reader_launch(int port) {
+	reader_rec *r = &reader[port];
+	int n = rx_head[port] - rx_tail[port];
+
+	reader_halt(port);	/* join a reader that stopped on an error */
+	memcpy(r->buf, rx_buffer[port] + rx_tail[port], n);
+	for (r->head = 0; r->head < (unsigned) n; r->head++) {
+		r->stamp[r->head] = now_usec();
+	}
+	r->tail = 0;
+	rx_head[port] = rx_tail[port] = 0;
+
+	__atomic_store_n(&r->running, 1, __ATOMIC_RELEASE);
+	try {
+		r->thread = std::thread(reader_thread, port);
+	}
+	catch (...) {
+		__atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+		return 0;
+	}
+	return 1;
+}
+
+
+//   H O S T _ S T A R T _ R E A D E R
+// host_start_reader() hands the port's input over to a reader thread.
+// The read functions then only copy from its ring, so the auxiliary task
+// checking for packets makes no Linux read() calls.  priority > 0 asks
+// for SCHED_FIFO at that priority.  The reader survives
+// host_close_serial()/host_open_serial() until stopped.
+// Returns False (zero) if the thread could not be started.
+int host_start_reader(int port, int priority) {
+	if (!host_port_valid(port)) {
+		return 0;
+	}
+	reader[port].wanted = 1;
+	reader[port].priority = priority;
+	if (reader_on(port) || !port_open[port]) {
+		return 1;
+	}
+	return reader_launch(port);
+}
+
+
+//   H O S T _ S T O P _ R E A D E R
+// host_stop_reader() gives the port's input back to direct reads
+void host_stop_reader(int port) {
+	if (!host_port_valid(port)) {
+		return;
+	}
+	reader[port].wanted = 0;
+	reader_halt(port);
+}
+
+
+//   H O S T _ A R R I V A L _ U S E C
+// host_arrival_usec() returns when the last char handed out by the read
+// functions arrived, in usec on CLOCK_MONOTONIC.  Without a reader
+// thread it is when the char was read from the UART, which is as soon
+// as it arrives while host_read_bytes() is waiting.
+unsigned long long host_arrival_usec(int port) {
+	return last_arrival[port];
 }
 
 
@@ -75,6 +401,23 @@ int host_timed_out(int port) {
 /* Serial i/o Functions */
 /*----------------------*/
 
+int host_get_id(int port) {
+  return 0;
+}
+
+
+//   H O S T _ S E T _ D E V I C E
+// host_set_device() chooses the device file opened for the given port,
+// e.g. host_set_device(1, "/dev/ttyS1").  Call before connecting.
+// Returns False (zero) if the port number is not valid.
+int host_set_device(int port, char *device) {
+  if (!host_port_valid(port)) {
+    return 0;
+  }
+  port_dev[port] = device;
+  return 1;
+}
+
 /*--------------------------------*/
 /* Fixing up baud rate parameters */
 /*--------------------------------*/
@@ -85,7 +428,204 @@ int host_timed_out(int port) {
 // Takes small arguments as shorthand:
 // 115 --> 115200, 38 or 384 --> 38400, 96 --> 9600 etc.
 void host_fix_baud(long int *baud) {
-  // unify baud rate formats
+  switch (*baud) {
+    case 115200L:
+    case 1152L:
+    case 115L:
+      *baud = 115200L;
+      break;
+    case 57600L:
+    case 576L:
+    case 57L:
+      *baud = 57600L;
+      break;
+    case 38400L:
+    case 384L:
+    case 38L:
+      *baud = 38400L;
+      break;
+    case 19200L:
+    case 192L:
+    case 19L:
+      *baud = 19200L;
+      break;
+    case 9600L:
+    case 96L:
+      *baud = 9600L;
+      break;
+    default:
+      if (*baud < 1000L) *baud *= 1000;
+      if (*baud > 86400L) *baud = 115200L;
+      else if (*baud > 48000L) *baud = 57600L;
+      else if (*baud > 28800L) *baud = 38400L;
+      else if (*baud > 14400L) *baud = 19200L;
+      else *baud = 9600L;
+      break;
+  }
+}
+
+/*------------------------------*/
+/* Low-latency UART profile     */
+/*------------------------------*/
+
+
+//   S Y S F S _ R E A D / W R I T E
+// sysfs_read() and sysfs_write() access an integer attribute of the
+// port's tty in /sys/class/tty.  sysfs_read() returns -1 if the driver
+// has no such attribute; sysfs_write() returns False (zero) on failure.
+// sysfs_path() builds the attribute's path, and fails rather than hand
+// them a truncated one.
+static int sysfs_path(int port, const char *attr, char *path, int size) {
+	char real[PATH_MAX];
+	const char *name;
+	int n;
+
+	if (realpath(port_dev[port], real) == NULL) {
+		return 0;
+	}
+	name = strrchr(real, '/');
+	n = snprintf(path, size, "/sys/class/tty/%s/%s", name ? name + 1 : real, attr);
+	return n > 0 && n < size;
+}
+
+static int sysfs_read(int port, const char *attr) {
+	char path[PATH_MAX];
+	FILE *f;
+	int value = -1;
+
+	if (!sysfs_path(port, attr, path, sizeof(path)) || (f = fopen(path, "r")) == NULL) {
+		return -1;
+	}
+	if (fscanf(f, "%d", &value) != 1) {
+		value = -1;
+	}
+	fclose(f);
+	return value;
+}
+
+static int sysfs_write(int port, const char *attr, int value) {
+	char path[PATH_MAX];
+	FILE *f;
+	int ok;
+
+	if (!sysfs_path(port, attr, path, sizeof(path)) || (f = fopen(path, "w")) == NULL) {
+		return 0;
+	}
+	ok = fprintf(f, "%d", value) > 0;
+	return (fclose(f) == 0) && ok;
+}
+
+
+//   L A T E N C Y _ A P P L Y
+// latency_apply() puts an open port into the low-latency profile:
+//   ASYNC_LOW_LATENCY, so the driver pushes each rx interrupt's chars to
+//     the tty at once instead of from a deferred work queue,
+//   an rx FIFO trigger of 1 char (8250 UARTs), so the UART raises an
+//     interrupt per char instead of waiting for a fill level or its
+//     4-char-time idle timeout,
+//   a 1 ms latency timer (FTDI and similar USB adapters, default 16 ms).
+// Settings the driver does not offer, or that need more privileges,
+// are skipped; host_get_uart_profile() shows what took effect.
+// VMIN is left as gSerial sets it: its reads wait in poll(), which
+// wakes on the first char whatever VMIN is.
+static void latency_apply(int port) {
+	struct serial_struct ss;
+	int fd = profile_fd(port);
+
+	latency[port].old_flags = -1;
+	if (fd >= 0 && ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+		latency[port].old_flags = ss.flags;
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(fd, TIOCSSERIAL, &ss) < 0) {
+			latency[port].old_flags = -1;
+		}
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	latency[port].old_rx_trigger = sysfs_read(port, RX_TRIGGER_ATTR);
+	if (latency[port].old_rx_trigger > 1 && !sysfs_write(port, RX_TRIGGER_ATTR, 1)) {
+		latency[port].old_rx_trigger = -1;
+	}
+
+	latency[port].old_latency_timer = sysfs_read(port, LATENCY_TIMER_ATTR);
+	if (latency[port].old_latency_timer > 1 && !sysfs_write(port, LATENCY_TIMER_ATTR, 1)) {
+		latency[port].old_latency_timer = -1;
+	}
+}
+
+
+//   L A T E N C Y _ R E S T O R E
+// latency_restore() undoes latency_apply() before the port is closed
+static void latency_restore(int port) {
+	struct serial_struct ss;
+	int fd;
+
+	if (latency[port].old_flags >= 0 && (fd = profile_fd(port)) >= 0) {
+		if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+			ss.flags = latency[port].old_flags;
+			ioctl(fd, TIOCSSERIAL, &ss);
+		}
+		close(fd);
+	}
+	if (latency[port].old_rx_trigger > 1) {
+		sysfs_write(port, RX_TRIGGER_ATTR, latency[port].old_rx_trigger);
+	}
+	if (latency[port].old_latency_timer > 1) {
+		sysfs_write(port, LATENCY_TIMER_ATTR, latency[port].old_latency_timer);
+	}
+	latency[port].old_flags = -1;
+	latency[port].old_rx_trigger = -1;
+	latency[port].old_latency_timer = -1;
+}
+
+
+//   H O S T _ S E T _ L O W _ L A T E N C Y
+// host_set_low_latency() turns the low-latency profile of a port on or
+// off.  It takes effect at once on an open port and is re-applied each
+// time host_open_serial() opens it (e.g. after a baud change).
+// Returns False (zero) if the port number is not valid.
+int host_set_low_latency(int port, int on) {
+	if (!host_port_valid(port)) {
+		return 0;
+	}
+	if (port_open[port] && on && !latency[port].wanted) {
+		latency_apply(port);
+	}
+	if (port_open[port] && !on && latency[port].wanted) {
+		latency_restore(port);
+	}
+	latency[port].wanted = on;
+	return 1;
+}
+
+
+//   H O S T _ G E T _ U A R T _ P R O F I L E
+// host_get_uart_profile() reports the settings in effect on an open port,
+// read back from the driver.  Fields the driver does not offer are -1.
+// Returns False (zero) if the port is not open.
+int host_get_uart_profile(int port, host_uart_profile *profile) {
+	struct serial_struct ss;
+	struct termios setup;
+	int fd;
+
+	if (!host_port_valid(port) || !port_open[port] || (fd = profile_fd(port)) < 0) {
+		return 0;
+	}
+	profile->low_latency = -1;
+	if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+		profile->low_latency = (ss.flags & ASYNC_LOW_LATENCY) != 0;
+	}
+	profile->vmin = profile->vtime = -1;
+	if (tcgetattr(fd, &setup) == 0) {
+		profile->vmin = setup.c_cc[VMIN];
+		profile->vtime = setup.c_cc[VTIME];
+	}
+	close(fd);
+	profile->rx_trigger = sysfs_read(port, RX_TRIGGER_ATTR);
+	profile->latency_timer = sysfs_read(port, LATENCY_TIMER_ATTR);
+	return 1;
 }
 
 /*--------------------------*/
@@ -98,14 +638,22 @@ void host_fix_baud(long int *baud) {
 // Always uses 8 data bits, 1 stop bit, no parity.
 // Returns False (zero) if called with zero baud rate.
 int host_open_serial(int port, long int baud) {
-  if (baud == 0) {
+  if (baud == 0 || !host_port_valid(port)) {
     return 0;
   }
   
   rt_printf("host_open_serial inside drive.cpp\n"); //-----------------------------
   
-  if (gSerial.setup ("/dev/ttyS4", baud) == 0) {
+  rx_head[port] = rx_tail[port] = 0;
+  if (gSerial[port].setup (port_dev[port], baud) == 0) {
   	rt_printf("gSerial.setup() returned 0\n"); //-----------------------------
+  	port_open[port] = 1;
+  	if (latency[port].wanted) {
+  		latency_apply(port);
+  	}
+  	if (reader[port].wanted) {
+  		reader_launch(port);
+  	}
   	return 1;
   }
   else {
@@ -119,23 +667,74 @@ int host_open_serial(int port, long int baud) {
 // host_close_serial() closes the given serial port.
 //  NEVER call this without first calling host_open_serial() on the same port.
 void host_close_serial(int port) {
-  //SerialArm.end();
-  // blank
+  reader_halt(port);
+  if (port_open[port] && latency[port].wanted) {
+    latency_restore(port);
+  }
+  gSerial[port].cleanup();
+  port_open[port] = 0;
   //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 }
 
 
+//   B A U D _ T O _ S P E E D
+// baud_to_speed() converts a fixed-up baud rate to a termios speed_t
+static speed_t baud_to_speed(long int baud) {
+	switch (baud) {
+		case 115200L:
+			return B115200;
+		case 57600L:
+			return B57600;
+		case 38400L:
+			return B38400;
+		case 19200L:
+			return B19200;
+		default:
+			return B9600;
+	}
+}
+
+
+//   H O S T _ S E T _ B A U D
+// host_set_baud() changes the line speed of an open port once the chars
+// already written have gone out.  Unlike closing and reopening the port,
+// it keeps gSerial and the input received so far.  The speed belongs to
+// the tty, so a second fd can set it for gSerial's.
+// Returns False (zero) if the speed could not be set
+int host_set_baud(int port, long int baud) {
+	struct termios setup;
+	int fd, ok = 0;
+
+	if (baud == 0 || !host_port_valid(port) || !port_open[port]
+		|| (fd = profile_fd(port)) < 0) {
+		return 0;
+	}
+	host_fix_baud(&baud);
+	if (tcgetattr(fd, &setup) == 0) {
+		cfsetspeed(&setup, baud_to_speed(baud));
+		ok = tcsetattr(fd, TCSADRAIN, &setup) == 0;
+	}
+	close(fd);
+	return ok;
+}
+
+
 //   H O S T _ F L U S H _ S E R I A L
 // host_flush_serial() flushes and resets the serial i/o buffers
 void host_flush_serial(int port) {
-	/*
 	char tempBuffer[maxLen];
-	int ret = gSerial.read(tempBuffer, maxLen, 100);
-	while (ret > 0)
-	{	
+
+	rx_head[port] = rx_tail[port] = 0;
+	if (reader_on(port)) {
+		/* the reader owns the tty; drop what it has collected */
+		__atomic_store_n(&reader[port].tail,
+			__atomic_load_n(&reader[port].head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+		return;
+	}
+	while (gSerial[port].read(tempBuffer, maxLen, 0) > 0)
+	{
 		// Do nothing
 	}
-	*/
 }
 
 /*------------------*/
@@ -143,27 +742,79 @@ void host_flush_serial(int port) {
 /*------------------*/
 
 
+//   F I L L _ R X
+// fill_rx() moves everything the port has pending into its rx_buffer
+// with a single read, waiting at most wait_ms for the first char.
+// Returns # of chars buffered.
+static int fill_rx(int port, int wait_ms) {
+	if (rx_head[port] == rx_tail[port]) {
+		rx_head[port] = rx_tail[port] = 0;
+	}
+	if (rx_head[port] < maxLen) {
+		int ret = gSerial[port].read(rx_buffer[port] + rx_head[port],
+			maxLen - rx_head[port], wait_ms);
+		if (ret > 0) {
+			rx_head[port] += ret;
+			rx_stamp[port] = now_usec();
+		}
+	}
+	return rx_head[port] - rx_tail[port];
+}
+
+
 //   H O S T _ R E A D _ C H A R
 // host_read_char() reads one character from the serial input buffer.
 // returns -1 if input buffer is empty
 int host_read_char(int port) {
-	
-	char tempBuffer[maxLen];
-	int ret = gSerial.read(tempBuffer, 1, 100);
-	if (ret > 0)
-	{	
-		int ch = tempBuffer[0];
-		
-			
-		//rt_printf(tempBuffer);
-		
-		return ch;
-	}
-	//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-
-	else {
+	char c;
+
+	if (reader_on(port)) {
+		return ring_take(port, &c, 1) ? (unsigned char) c : -1;
+	}
+	if (rx_head[port] == rx_tail[port] && fill_rx(port, 0) == 0) {
+		return -1;
+	}
+	last_arrival[port] = rx_stamp[port];
+	return (unsigned char) rx_buffer[port][rx_tail[port]++];
+}
+
+
+//   H O S T _ R E A D _ B U F F E R E D
+// host_read_buffered() reads one character that the driver already
+// holds, without asking gSerial for more.
+// returns -1 if nothing is buffered
+int host_read_buffered(int port) {
+	char c;
+
+	if (reader_on(port)) {
+		return ring_take(port, &c, 1) ? (unsigned char) c : -1;
+	}
+	if (rx_head[port] == rx_tail[port]) {
 		return -1;
 	}
+	last_arrival[port] = rx_stamp[port];
+	return (unsigned char) rx_buffer[port][rx_tail[port]++];
+}
+
+
+//   H O S T _ R E A D _ A V A I L A B L E
+// host_read_available() copies up to max chars that have already
+// arrived into buf without waiting.  Returns # of chars copied.
+int host_read_available(int port, char *buf, int max) {
+	int n;
+
+	if (reader_on(port)) {
+		return ring_take(port, buf, max);
+	}
+	n = rx_head[port] - rx_tail[port];
+	if (n == 0) {
+		n = fill_rx(port, 0);
+	}
+	if (n > max) n = max;
+	if (n > 0) last_arrival[port] = rx_stamp[port];
+	memcpy(buf, rx_buffer[port] + rx_tail[port], n);
+	rx_tail[port] += n;
+	return n;
 }
 
 
@@ -171,12 +822,12 @@ int host_read_char(int port) {
 // host_read_bytes() will try to read a specified number of bytes
 // until the timeout period of time expires.  It returns the number
 // of bytes it actually read.
+// Waits inside gSerial.read() for the rest of the timeout instead of spinning.
 int host_read_bytes(int port, char *buf, int count, float timeout) {
   // host_set_timeout(port, timeout);
   // Serial.print("HOST_READ_BYTES");
   // return SerialArm.readBytesUntil('\0', buf, count);
   int read;
-  int ch;
 
   /* setup the timeout */
   read = 0;
@@ -185,12 +836,13 @@ int host_read_bytes(int port, char *buf, int count, float timeout) {
 
   while (!host_timed_out(port))
   {
-    if ((ch = host_read_char(port)) != -1) {
-      *buf = (char) ch;
-      buf++;
-      if (++read == count)
-        break;
-    }
+    read += host_read_available(port, buf + read, count - read);
+    if (read == count)
+      break;
+    if (reader_on(port))
+      host_pause(READER_WAIT);	/* RT-safe sleep, no Linux syscall */
+    else if (rx_head[port] == rx_tail[port])
+      fill_rx(port, msec_left(port));
   }
 
   return read;
@@ -204,7 +856,7 @@ int host_read_bytes(int port, char *buf, int count, float timeout) {
 int host_write_char(int port, int ch) {
 	
   char c = ch;	
-  gSerial.write(&c, 1);
+  gSerial[port].write(&c, 1);
 //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
   return 1;
@@ -218,13 +870,22 @@ int host_write_char(int port, int ch) {
 int host_write_string(int port, char *str) {
 	
 	rt_printf("writing string from drive.cpp \n"); //--------------------------------------------------------	
-  gSerial.write(str);
+  gSerial[port].write(str);
   //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
   
   return 1;
   // Is this correct? Should NULL be added?
 }
 
+//   H O S T _ W R I T E _ B Y T E S
+// host_write_bytes() writes count chars from buf with a single
+// gSerial.write(), so a whole command costs one syscall.
+// Returns True (non-zero) if successful
+int host_write_bytes(int port, char *buf, int count) {
+  gSerial[port].write(buf, count);
+  return 1;
+}
+
 /*----------------------------*/
 /* Getting Serial Port Status */
 /*----------------------------*/
@@ -233,8 +894,7 @@ int host_write_string(int port, char *str) {
 //   H O S T _ P O R T _ V A L I D
 // host_port_valid() returns True if the specified port number is valid
 int host_port_valid(int port) {
-  return true;
-  //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< FIX?
+  return (port >= 0) && (port < NUM_PORTS);
 }
 
 
@@ -243,14 +903,83 @@ int host_port_valid(int port) {
 int host_input_count(int port) {
   //return SerialArm.available();
   
-  return gSerial.available();
+  if (reader_on(port)) {
+    return ring_count(port);
+  }
+  return gSerial[port].available() + rx_head[port] - rx_tail[port];
   //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< FIX?
 }
 
 //   H O S T _ I N P U T _ F U L L
 // host_input_full() tells whether or not the serial input queue is full
-int host_input_full() {
+int host_input_full(int port) {
 	return false;
   //return ((64 - SerialArm.available()) == 0);
   //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< FIX?
 }
+
+
+/*-------------------*/
+/* Calibration Cache */
+/*-------------------*/
+
+#define CACHE_NAME_SIZE 48
+
+
+//   C A C H E _ F I L E
+// cache_file() makes the file name for a cache key: MS<key>.CAL in the
+// current directory (like MSTIP.DAT), keeping only letters and digits.
+static void cache_file(char *key, char *name, int size) {
+	int n = 0;
+
+	name[n++] = 'M';
+	name[n++] = 'S';
+	for (; *key && n < size - 9; key++) {
+		if (isalnum((unsigned char) *key)) {
+			name[n++] = *key;
+		}
+	}
+	strcpy(name + n, ".CAL");
+}
+
+
+//   H O S T _ L O A D _ C A C H E
+// host_load_cache() reads the record saved under key into buf.
+// Returns False (zero) unless there is one of exactly size bytes.
+int host_load_cache(char *key, void *buf, int size) {
+	char name[CACHE_NAME_SIZE];
+	FILE *f;
+	int ok;
+
+	cache_file(key, name, sizeof(name));
+	if ((f = fopen(name, "rb")) == NULL) {
+		return 0;
+	}
+	ok = fread(buf, 1, size, f) == (size_t) size && fgetc(f) == EOF;
+	fclose(f);
+	return ok;
+}
+
+
+//   H O S T _ S A V E _ C A C H E
+// host_save_cache() saves size bytes of buf under key, replacing any
+// record there.  The record goes to a new file that is then renamed over
+// the old one, so an interrupted save never leaves half a record.
+// Returns False (zero) if it could not be saved.
+int host_save_cache(char *key, void *buf, int size) {
+	char name[CACHE_NAME_SIZE], temp[CACHE_NAME_SIZE + 4];
+	FILE *f;
+	int ok;
+
+	cache_file(key, name, sizeof(name));
+	snprintf(temp, sizeof(temp), "%s.new", name);
+	if ((f = fopen(temp, "wb")) == NULL) {
+		return 0;
+	}
+	ok = fwrite(buf, 1, size, f) == (size_t) size;
+	ok = (fclose(f) == 0) && ok && rename(temp, name) == 0;
+	if (!ok) {
+		remove(temp);
+	}
+	return ok;
+}
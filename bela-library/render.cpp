@@ -30,9 +30,8 @@
 extern "C" {
 #include "hci.h"		// Microscribe fundamentals
 #include "arm.h"		// Arm specific functions
-}
-
 #include "drive.h"		// Platfom specific functions
+}
 
 
 
@@ -83,10 +82,27 @@ bool setup(BelaContext *context, void *userData) {
 	rt_printf("arm_install_simple\n");
 	arm_install_simple(&arm);
 	
+	// Let a Linux reader thread own the serial input, so serialIo() below
+	// only copies bytes from memory instead of calling read()
+	host_start_reader(port, 0);
+	
+	// Have the UART hand over each byte as soon as it arrives
+	host_set_low_latency(port, 1);
+	
+	// Reuse the constants saved from an earlier session with this arm
+	arm_use_cache(&arm);
+	
 	arm_result result;
 	rt_printf("arm_connect\n");
 	result = arm_connect(&arm, port, baud);
-	rt_printf("Result: %s\n", result); //-----------------------------------------------------------------------
+	rt_printf("Result: %s\n", hci_result_string(result)); //-----------------------------------------------------------------------
+	rt_printf("Sign-on: %lu us, arm found at %ld baud\n", arm.hci.signon_usec,
+		arm.hci.signon_baud);
+	
+	host_uart_profile uart;
+	if (host_get_uart_profile(port, &uart))
+		rt_printf("UART: low latency %d, rx trigger %d, latency timer %d, VMIN %d, VTIME %d\n",
+			uart.low_latency, uart.rx_trigger, uart.latency_timer, uart.vmin, uart.vtime);
 	
 	AuxiliaryTask serialCommsTask = Bela_createAuxiliaryTask(serialIo, 0, "serial-thread", NULL);
 	Bela_scheduleAuxiliaryTask(serialCommsTask);
@@ -119,4 +135,7 @@ void render(BelaContext *context, void *userData)
 	}
 }
 
-void cleanup(BelaContext *context, void *userData) {}
+void cleanup(BelaContext *context, void *userData)
+{
+	host_stop_reader(port);
+}
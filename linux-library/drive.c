@@ -0,0 +1,1039 @@
+/**************************************************
+   - - - P E G G Y   I N S T R U M E N T S - - -
+*                                                 *
+         MicroScribe Linux Driver
+*                                                 *
+***************************************************
+   DRIVE.C | October 2026 | Mårten Nettelbladt
+
+   Plain termios driver for any Linux serial port (on-board UART or
+   USB adapter).  Reads block in ppoll() on the tty until data arrives
+   or the port's timeout runs out, so waiting for a packet costs no CPU.
+
+   Build together with the rest of the library, e.g.
+   cc -O2 -o microscribe main.c arm.c hci.c drive.c -lm
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#include "drive.h"
+
+#define NUM_PORTS       4
+#define FRAME_BUF_SIZE  256
+#define RING_SIZE       4096    /* reader thread ring, a power of two */
+#define RING_MASK       (RING_SIZE - 1)
+
+/* Device files behind port numbers 1..NUM_PORTS.
+   Use host_set_device() to point a port somewhere else. */
+static char *port_dev[NUM_PORTS + 1] = {
+  NULL, "/dev/ttyS0", "/dev/ttyS1", "/dev/ttyUSB0", "/dev/ttyUSB1"
+};
+
+static int  port_ref[NUM_PORTS + 1] = { -1, -1, -1, -1, -1 };
+static struct termios old_setup[NUM_PORTS + 1];
+
+/* Bytes already read from the tty but not yet handed out */
+static char frame_buffer[NUM_PORTS + 1][FRAME_BUF_SIZE];
+static int  frame_head[NUM_PORTS + 1];      /* chars come in here */
+static int  frame_tail[NUM_PORTS + 1];      /* chars are read out here */
+static unsigned long long frame_stamp[NUM_PORTS + 1];  /* time of the last read(), usec */
+
+/* Timeout length and deadline of each port, on CLOCK_MONOTONIC */
+static struct timespec timeout[NUM_PORTS + 1];
+static struct timespec stop[NUM_PORTS + 1];
+
+/* Optional reader thread of a port (see host_start_reader()).
+   The ring is single-producer/single-consumer: only the reader thread
+   moves head, only the application moves tail. */
+typedef struct {
+  pthread_t       thread;
+  int             wanted;         /* keep a reader on this port across reopens */
+  int             priority;       /* SCHED_FIFO priority, 0 = normal scheduling */
+  int             running;
+  int             joinable;       /* thread was started and not yet joined */
+  int             ready;          /* lock and arrived are initialized */
+  unsigned        head;           /* next free slot */
+  unsigned        tail;           /* next char to hand out */
+  char            buf[RING_SIZE];
+  unsigned long long stamp[RING_SIZE];  /* arrival of each char, usec */
+  int             waiting;        /* application sleeps in host_read_bytes() */
+  pthread_mutex_t lock;
+  pthread_cond_t  arrived;
+} reader_rec;
+
+static reader_rec reader[NUM_PORTS + 1];
+
+/* Arrival time of the last char handed out by the read functions */
+static unsigned long long last_arrival[NUM_PORTS + 1];
+
+/* Low-latency profile of a port (see host_set_low_latency()).
+   The old_ values are put back by host_close_serial(); -1 = untouched. */
+typedef struct {
+  int wanted;               /* apply the profile whenever the port opens */
+  int old_flags;            /* serial_struct flags */
+  int old_rx_trigger;       /* UART rx FIFO trigger level, bytes */
+  int old_latency_timer;    /* USB serial latency timer, ms */
+} latency_rec;
+
+static latency_rec latency[NUM_PORTS + 1];
+
+#define RX_TRIGGER_ATTR     "rx_trig_bytes"
+#define LATENCY_TIMER_ATTR  "device/latency_timer"
+
+
+/*------------------*/
+/* Timing Functions */
+/*------------------*/
+
+//   T I M E S P E C _ A D D
+// timespec_add() adds b to a, keeping tv_nsec normalized
+static void timespec_add(struct timespec *a, const struct timespec *b) {
+  a->tv_sec += b->tv_sec;
+  a->tv_nsec += b->tv_nsec;
+  if (a->tv_nsec >= 1000000000L) {
+    a->tv_sec++;
+    a->tv_nsec -= 1000000000L;
+  }
+}
+
+
+//   T I M E _ L E F T
+// time_left() stores the time remaining until the port's deadline.
+// Returns False (zero) if the deadline has already passed.
+static int time_left(int port, struct timespec *left) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left->tv_sec = stop[port].tv_sec - now.tv_sec;
+  left->tv_nsec = stop[port].tv_nsec - now.tv_nsec;
+  if (left->tv_nsec < 0) {
+    left->tv_sec--;
+    left->tv_nsec += 1000000000L;
+  }
+  return (left->tv_sec > 0 || (left->tv_sec == 0 && left->tv_nsec > 0));
+}
+
+
+//   N O W _ U S E C
+// now_usec() returns the monotonic clock in microseconds
+static unsigned long long now_usec(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+
+//   H O S T _ C L O C K _ U S E C
+// host_clock_usec() reads a free-running microsecond clock for timing
+// intervals.  It wraps around, so only unsigned differences are meaningful.
+unsigned long host_clock_usec(void) {
+  return (unsigned long) now_usec();
+}
+
+
+//   H O S T _ P A U S E
+// host_pause() pauses for the given number of seconds
+// Sleeps until an absolute deadline, so a signal cannot stretch the pause.
+void host_pause(float delay_sec) {
+  struct timespec delay, deadline;
+
+  if (delay_sec <= 0) return;
+  delay.tv_sec = (time_t) delay_sec;
+  delay.tv_nsec = (long) ((delay_sec - (float) delay.tv_sec) * 1e9);
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  timespec_add(&deadline, &delay);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    ;
+}
+
+
+//   H O S T _ G E T _ T I M E O U T
+// host_get_timeout() gets the timeout period of the given port in seconds
+float host_get_timeout(int port) {
+  return (float) timeout[port].tv_sec + (float) timeout[port].tv_nsec * 1e-9;
+}
+
+
+//   H O S T _ S E T _ T I M E O U T
+// host_set_timeout() sets the length of all future timeout periods to the given # of seconds
+void host_set_timeout(int port, float timeout_sec) {
+  if (timeout_sec < 0) timeout_sec = 0;
+  timeout[port].tv_sec = (time_t) timeout_sec;
+  timeout[port].tv_nsec = (long) ((timeout_sec - (float) timeout[port].tv_sec) * 1e9);
+}
+
+
+//   H O S T _ S T A R T _ T I M E O U T
+// host_start_timeout() starts a timer for the specified port.
+// Call host_timed_out() to find out whether time is up.
+void host_start_timeout(int port) {
+  clock_gettime(CLOCK_MONOTONIC, &stop[port]);
+  timespec_add(&stop[port], &timeout[port]);
+}
+
+
+//   H O S T _ T I M E D _ O U T
+// host_timed_out() returns True if the previously-started timeout
+// period is over.  Returns False if not.
+int host_timed_out(int port) {
+  struct timespec left;
+
+  return !time_left(port, &left);
+}
+
+
+/*---------------*/
+/* Reader Thread */
+/*---------------*/
+
+//   R E A D E R _ O N
+// reader_on() returns True if a reader thread owns the port's input
+static int reader_on(int port) {
+  return __atomic_load_n(&reader[port].running, __ATOMIC_ACQUIRE);
+}
+
+
+//   R I N G _ C O U N T
+// ring_count() returns the # of chars waiting in the port's ring
+static unsigned ring_count(int port) {
+  return __atomic_load_n(&reader[port].head, __ATOMIC_SEQ_CST) - reader[port].tail;
+}
+
+
+//   R I N G _ T A K E
+// ring_take() moves up to max chars out of the port's ring into buf.
+// Returns # of chars moved.
+static int ring_take(int port, char *buf, int max) {
+  reader_rec *r = &reader[port];
+  unsigned tail = r->tail;
+  unsigned n = ring_count(port);
+  unsigned first;
+
+  if (n > (unsigned) max) n = max;
+  if (n == 0) return 0;
+  first = RING_SIZE - (tail & RING_MASK);
+  if (first > n) first = n;
+  memcpy(buf, r->buf + (tail & RING_MASK), first);
+  memcpy(buf + first, r->buf, n - first);
+  last_arrival[port] = r->stamp[(tail + n - 1) & RING_MASK];
+  __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+
+//   R I N G _ W A I T
+// ring_wait() sleeps until the reader has put something in the port's
+// ring or the port's deadline passes.  Returns # of chars waiting.
+static unsigned ring_wait(int port) {
+  reader_rec *r = &reader[port];
+
+  pthread_mutex_lock(&r->lock);
+  __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+  while (ring_count(port) == 0 && reader_on(port)) {
+    if (pthread_cond_timedwait(&r->arrived, &r->lock, &stop[port]) == ETIMEDOUT)
+      break;
+  }
+  __atomic_store_n(&r->waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&r->lock);
+  return ring_count(port);
+}
+
+
+//   R E A D E R _ T H R E A D
+// reader_thread() owns the tty of one port: it sleeps in poll() and moves
+// every char that arrives into the ring together with its arrival time.
+// On a hangup or an error other than EINTR it stops by itself, and the
+// port goes back to direct reads.  Chars left in the ring are discarded.
+static void *reader_thread(void *arg) {
+  int port = (int) (long) arg;
+  reader_rec *r = &reader[port];
+  struct pollfd pfd;
+  unsigned head, space, chunk, i;
+  unsigned long long now;
+  int got;
+
+  pfd.fd = port_ref[port];
+  pfd.events = POLLIN;
+  while (__atomic_load_n(&r->running, __ATOMIC_ACQUIRE)) {
+    head = r->head;
+    space = RING_SIZE - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+    if (space == 0) {
+      host_pause(1e-3);           /* application is behind, let the tty hold it */
+      continue;
+    }
+    got = poll(&pfd, 1, 50);      /* wake up now and then to see if we should stop */
+    if (got == 0 || (got < 0 && errno == EINTR)) continue;
+    if (got < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) break;
+
+    chunk = RING_SIZE - (head & RING_MASK);
+    if (chunk > space) chunk = space;
+    got = read(pfd.fd, r->buf + (head & RING_MASK), chunk);
+    if (got == 0 || (got < 0 && (errno == EINTR || errno == EAGAIN))) continue;
+    if (got < 0) break;
+
+    now = now_usec();
+    for (i = 0; i < (unsigned) got; i++) {
+      r->stamp[(head + i) & RING_MASK] = now;
+    }
+    __atomic_store_n(&r->head, head + got, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&r->lock);
+      pthread_cond_signal(&r->arrived);
+      pthread_mutex_unlock(&r->lock);
+    }
+  }
+
+  /* If stopped by an error, wake an application waiting in ring_wait() */
+  __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&r->lock);
+  pthread_cond_signal(&r->arrived);
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+
+//   R E A D E R _ H A L T
+// reader_halt() stops the reader thread of a port, if it has one, or
+// joins one that has stopped by itself.
+// Chars still in the ring are discarded.
+static void reader_halt(int port) {
+  reader_rec *r = &reader[port];
+
+  if (!r->joinable) return;
+  __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+  pthread_join(r->thread, NULL);
+  r->joinable = 0;
+  r->head = r->tail = 0;
+}
+
+
+//   R E A D E R _ L A U N C H
+// reader_launch() starts the reader thread of an open port.  Chars that
+// were already buffered are moved to the ring first.
+// Returns False (zero) if the thread could not be started.
+static int reader_launch(int port) {
+  reader_rec *r = &reader[port];
+  pthread_condattr_t cattr;
+  pthread_attr_t attr;
+  struct sched_param param;
+  int n, err = -1;
+
+  reader_halt(port);              /* join a reader that stopped on an error */
+  if (!r->ready) {
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&r->arrived, &cattr);
+    pthread_condattr_destroy(&cattr);
+    r->ready = 1;
+  }
+
+  n = frame_head[port] - frame_tail[port];
+  memcpy(r->buf, frame_buffer[port] + frame_tail[port], n);
+  for (r->head = 0; r->head < (unsigned) n; r->head++) {
+    r->stamp[r->head] = now_usec();
+  }
+  r->tail = 0;
+  frame_head[port] = frame_tail[port] = 0;
+
+  __atomic_store_n(&r->running, 1, __ATOMIC_RELEASE);
+  if (r->priority > 0) {
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = r->priority;
+    pthread_attr_setschedparam(&attr, &param);
+    err = pthread_create(&r->thread, &attr, reader_thread, (void *) (long) port);
+    pthread_attr_destroy(&attr);
+  }
+  if (err != 0) {
+    /* no priority asked for, or no permission for SCHED_FIFO */
+    err = pthread_create(&r->thread, NULL, reader_thread, (void *) (long) port);
+  }
+  if (err != 0) {
+    __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
+    return 0;
+  }
+  r->joinable = 1;
+  return 1;
+}
+
+
+//   H O S T _ S T A R T _ R E A D E R
+// host_start_reader() hands the port's input over to a reader thread.
+// The read functions then only copy from its ring, so checking for
+// packets never makes a syscall.  priority > 0 asks for SCHED_FIFO at
+// that priority (normal scheduling if not permitted).  The reader
+// survives host_close_serial()/host_open_serial() until stopped.
+// Returns False (zero) if the thread could not be started.
+int host_start_reader(int port, int priority) {
+  if (!host_port_valid(port)) {
+    return 0;
+  }
+  reader[port].wanted = 1;
+  reader[port].priority = priority;
+  if (reader_on(port) || port_ref[port] < 0) {
+    return 1;
+  }
+  return reader_launch(port);
+}
+
+
+//   H O S T _ S T O P _ R E A D E R
+// host_stop_reader() gives the port's input back to direct reads
+void host_stop_reader(int port) {
+  if (!host_port_valid(port)) {
+    return;
+  }
+  reader[port].wanted = 0;
+  reader_halt(port);
+}
+
+
+//   H O S T _ A R R I V A L _ U S E C
+// host_arrival_usec() returns when the last char handed out by the read
+// functions arrived, in usec on CLOCK_MONOTONIC.  Without a reader
+// thread it is when the char was read from the tty, which is as soon as
+// it arrives while host_read_bytes() is waiting.
+unsigned long long host_arrival_usec(int port) {
+  return last_arrival[port];
+}
+
+
+/*----------------------*/
+/* Serial i/o Functions */
+/*----------------------*/
+
+int host_get_id(int port) {
+  return 0;
+}
+
+
+//   H O S T _ S E T _ D E V I C E
+// host_set_device() chooses the device file opened for the given port,
+// e.g. host_set_device(1, "/dev/ttyAMA0").  Call before connecting.
+// Returns False (zero) if the port number is not valid.
+int host_set_device(int port, char *device) {
+  if (!host_port_valid(port)) {
+    return 0;
+  }
+  port_dev[port] = device;
+  return 1;
+}
+
+/*--------------------------------*/
+/* Fixing up baud rate parameters */
+/*--------------------------------*/
+
+
+//   H O S T _ F I X _ B A U D
+// host_fix_baud() finds nearest valid baud rate to the one given.
+// Takes small arguments as shorthand:
+// 115 --> 115200, 38 or 384 --> 38400, 96 --> 9600 etc.
+void host_fix_baud(long int *baud) {
+  switch (*baud) {
+    case 115200L:
+    case 1152L:
+    case 115L:
+      *baud = 115200L;
+      break;
+    case 57600L:
+    case 576L:
+    case 57L:
+      *baud = 57600L;
+      break;
+    case 38400L:
+    case 384L:
+    case 38L:
+      *baud = 38400L;
+      break;
+    case 19200L:
+    case 192L:
+    case 19L:
+      *baud = 19200L;
+      break;
+    case 9600L:
+    case 96L:
+      *baud = 9600L;
+      break;
+    default:
+      if (*baud < 1000L) *baud *= 1000;
+      if (*baud > 86400L) *baud = 115200L;
+      else if (*baud > 48000L) *baud = 57600L;
+      else if (*baud > 28800L) *baud = 38400L;
+      else if (*baud > 14400L) *baud = 19200L;
+      else *baud = 9600L;
+      break;
+  }
+}
+
+
+//   B A U D _ T O _ S P E E D
+// baud_to_speed() converts a fixed-up baud rate to a termios speed_t
+static speed_t baud_to_speed(long int baud) {
+  switch (baud) {
+    case 115200L:
+      return B115200;
+    case 57600L:
+      return B57600;
+    case 38400L:
+      return B38400;
+    case 19200L:
+      return B19200;
+    default:
+      return B9600;
+  }
+}
+
+/*------------------------------*/
+/* Low-latency UART profile     */
+/*------------------------------*/
+
+
+//   S Y S F S _ R E A D / W R I T E
+// sysfs_read() and sysfs_write() access an integer attribute of the
+// port's tty in /sys/class/tty.  sysfs_read() returns -1 if the driver
+// has no such attribute; sysfs_write() returns False (zero) on failure.
+// sysfs_path() builds the attribute's path, and fails rather than hand
+// them a truncated one.
+static int sysfs_path(int port, const char *attr, char *path, int size) {
+  char real[PATH_MAX];
+  const char *name;
+  int n;
+
+  if (realpath(port_dev[port], real) == NULL) {
+    return 0;
+  }
+  name = strrchr(real, '/');
+  n = snprintf(path, size, "/sys/class/tty/%s/%s", name ? name + 1 : real, attr);
+  return n > 0 && n < size;
+}
+
+static int sysfs_read(int port, const char *attr) {
+  char path[PATH_MAX];
+  FILE *f;
+  int value = -1;
+
+  if (!sysfs_path(port, attr, path, sizeof(path)) || (f = fopen(path, "r")) == NULL) {
+    return -1;
+  }
+  if (fscanf(f, "%d", &value) != 1) {
+    value = -1;
+  }
+  fclose(f);
+  return value;
+}
+
+static int sysfs_write(int port, const char *attr, int value) {
+  char path[PATH_MAX];
+  FILE *f;
+  int ok;
+
+  if (!sysfs_path(port, attr, path, sizeof(path)) || (f = fopen(path, "w")) == NULL) {
+    return 0;
+  }
+  ok = fprintf(f, "%d", value) > 0;
+  return (fclose(f) == 0) && ok;
+}
+
+
+//   L A T E N C Y _ A P P L Y
+// latency_apply() puts an open port into the low-latency profile:
+//   ASYNC_LOW_LATENCY, so the driver pushes each rx interrupt's chars to
+//     the tty at once instead of from a deferred work queue,
+//   an rx FIFO trigger of 1 char (8250 UARTs), so the UART raises an
+//     interrupt per char instead of waiting for a fill level or its
+//     4-char-time idle timeout,
+//   a 1 ms latency timer (FTDI and similar USB adapters, default 16 ms).
+// Settings the driver does not offer, or that need more privileges,
+// are skipped; host_get_uart_profile() shows what took effect.
+// VMIN is left at 0: reads never block, the wait is in ppoll(), which
+// wakes on the first char whatever VMIN is, and host_read_bytes() asks
+// for the whole rest of a packet in one call anyway.
+static void latency_apply(int port) {
+  struct serial_struct ss;
+  int fd = port_ref[port];
+
+  latency[port].old_flags = -1;
+  if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+    latency[port].old_flags = ss.flags;
+    ss.flags |= ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &ss) < 0) {
+      latency[port].old_flags = -1;
+    }
+  }
+
+  latency[port].old_rx_trigger = sysfs_read(port, RX_TRIGGER_ATTR);
+  if (latency[port].old_rx_trigger > 1 && !sysfs_write(port, RX_TRIGGER_ATTR, 1)) {
+    latency[port].old_rx_trigger = -1;
+  }
+
+  latency[port].old_latency_timer = sysfs_read(port, LATENCY_TIMER_ATTR);
+  if (latency[port].old_latency_timer > 1 && !sysfs_write(port, LATENCY_TIMER_ATTR, 1)) {
+    latency[port].old_latency_timer = -1;
+  }
+}
+
+
+//   L A T E N C Y _ R E S T O R E
+// latency_restore() undoes latency_apply() before the port is closed
+static void latency_restore(int port) {
+  struct serial_struct ss;
+
+  if (latency[port].old_flags >= 0 && ioctl(port_ref[port], TIOCGSERIAL, &ss) == 0) {
+    ss.flags = latency[port].old_flags;
+    ioctl(port_ref[port], TIOCSSERIAL, &ss);
+  }
+  if (latency[port].old_rx_trigger > 1) {
+    sysfs_write(port, RX_TRIGGER_ATTR, latency[port].old_rx_trigger);
+  }
+  if (latency[port].old_latency_timer > 1) {
+    sysfs_write(port, LATENCY_TIMER_ATTR, latency[port].old_latency_timer);
+  }
+  latency[port].old_flags = -1;
+  latency[port].old_rx_trigger = -1;
+  latency[port].old_latency_timer = -1;
+}
+
+
+//   H O S T _ S E T _ L O W _ L A T E N C Y
+// host_set_low_latency() turns the low-latency profile of a port on or
+// off.  It takes effect at once on an open port and is re-applied each
+// time host_open_serial() opens it (e.g. after a baud change).
+// Returns False (zero) if the port number is not valid.
+int host_set_low_latency(int port, int on) {
+  if (!host_port_valid(port)) {
+    return 0;
+  }
+  if (port_ref[port] >= 0 && on && !latency[port].wanted) {
+    latency_apply(port);
+  }
+  if (port_ref[port] >= 0 && !on && latency[port].wanted) {
+    latency_restore(port);
+  }
+  latency[port].wanted = on;
+  return 1;
+}
+
+
+//   H O S T _ G E T _ U A R T _ P R O F I L E
+// host_get_uart_profile() reports the settings in effect on an open port,
+// read back from the driver.  Fields the driver does not offer are -1.
+// Returns False (zero) if the port is not open.
+int host_get_uart_profile(int port, host_uart_profile *profile) {
+  struct serial_struct ss;
+  struct termios setup;
+
+  if (!host_port_valid(port) || port_ref[port] < 0) {
+    return 0;
+  }
+  profile->low_latency = -1;
+  if (ioctl(port_ref[port], TIOCGSERIAL, &ss) == 0) {
+    profile->low_latency = (ss.flags & ASYNC_LOW_LATENCY) != 0;
+  }
+  profile->rx_trigger = sysfs_read(port, RX_TRIGGER_ATTR);
+  profile->latency_timer = sysfs_read(port, LATENCY_TIMER_ATTR);
+  profile->vmin = profile->vtime = -1;
+  if (tcgetattr(port_ref[port], &setup) == 0) {
+    profile->vmin = setup.c_cc[VMIN];
+    profile->vtime = setup.c_cc[VTIME];
+  }
+  return 1;
+}
+
+/*--------------------------*/
+/* Configuring Serial Ports */
+/*--------------------------*/
+
+
+//   H O S T _ O P E N _ S E R I A L
+// host_open_serial() opens the given serial port with specified baud rate
+// Always uses 8 data bits, 1 stop bit, no parity.
+// Returns False (zero) if called with zero baud rate.
+int host_open_serial(int port, long int baud) {
+  struct termios new_setup;
+  int fd;
+
+  if (baud == 0 || !host_port_valid(port) || port_dev[port] == NULL) {
+    return 0;
+  }
+  if (port_ref[port] >= 0) {
+    host_close_serial(port);
+  }
+
+  /* O_NONBLOCK only so that open() does not wait for carrier detect */
+  fd = open(port_dev[port], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0) {
+    return 0;
+  }
+  if (tcgetattr(fd, &old_setup[port]) < 0) {
+    close(fd);
+    return 0;
+  }
+
+  /* Raw 8N1, no flow control, no char translation */
+  new_setup = old_setup[port];
+  cfmakeraw(&new_setup);
+  new_setup.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+  new_setup.c_cflag |= CS8 | CLOCAL | CREAD;
+  new_setup.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+  /* read() never blocks; waiting is done in ppoll() */
+  new_setup.c_cc[VMIN] = 0;
+  new_setup.c_cc[VTIME] = 0;
+
+  cfsetispeed(&new_setup, baud_to_speed(baud));
+  cfsetospeed(&new_setup, baud_to_speed(baud));
+  if (tcsetattr(fd, TCSANOW, &new_setup) < 0) {
+    close(fd);
+    return 0;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+  port_ref[port] = fd;
+  if (latency[port].wanted) {
+    latency_apply(port);
+  }
+  host_flush_serial(port);
+  if (reader[port].wanted) {
+    reader_launch(port);
+  }
+  return 1;
+}
+
+
+//   H O S T _ C L O S E _ S E R I A L
+// host_close_serial() closes the given serial port.
+//  NEVER call this without first calling host_open_serial() on the same port.
+void host_close_serial(int port) {
+  if (port_ref[port] < 0) {
+    return;
+  }
+  reader_halt(port);
+  if (latency[port].wanted) {
+    latency_restore(port);
+  }
+  tcdrain(port_ref[port]);
+  tcsetattr(port_ref[port], TCSANOW, &old_setup[port]);
+  close(port_ref[port]);
+  port_ref[port] = -1;
+}
+
+
+//   H O S T _ S E T _ B A U D
+// host_set_baud() changes the line speed of an open port once the chars
+// already written have gone out.  Unlike closing and reopening the port,
+// it keeps the port's settings and the input received so far.
+// Returns False (zero) if the speed could not be set
+int host_set_baud(int port, long int baud) {
+  struct termios setup;
+
+  if (baud == 0 || port_ref[port] < 0 || tcgetattr(port_ref[port], &setup) < 0) {
+    return 0;
+  }
+  host_fix_baud(&baud);
+  cfsetspeed(&setup, baud_to_speed(baud));
+  return tcsetattr(port_ref[port], TCSADRAIN, &setup) == 0;
+}
+
+
+//   H O S T _ F L U S H _ S E R I A L
+// host_flush_serial() flushes and resets the serial i/o buffers
+void host_flush_serial(int port) {
+  frame_head[port] = frame_tail[port] = 0;
+  if (port_ref[port] >= 0) {
+    tcflush(port_ref[port], TCIOFLUSH);
+  }
+  if (reader_on(port)) {
+    __atomic_store_n(&reader[port].tail,
+                     __atomic_load_n(&reader[port].head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+  }
+}
+
+/*------------------*/
+/* Input and Output */
+/*------------------*/
+
+
+//   F I L L _ F R A M E
+// fill_frame() moves whatever the tty has pending into the port's
+// frame buffer with a single read().  Returns # of chars buffered.
+static int fill_frame(int port) {
+  int got;
+
+  if (frame_head[port] == frame_tail[port]) {
+    frame_head[port] = frame_tail[port] = 0;
+  }
+  if (port_ref[port] >= 0 && frame_head[port] < FRAME_BUF_SIZE) {
+    got = read(port_ref[port], frame_buffer[port] + frame_head[port],
+               FRAME_BUF_SIZE - frame_head[port]);
+    if (got > 0) {
+      frame_head[port] += got;
+      frame_stamp[port] = now_usec();
+    }
+  }
+  return frame_head[port] - frame_tail[port];
+}
+
+
+//   H O S T _ R E A D _ C H A R
+// host_read_char() reads one character from the serial input buffer.
+// returns -1 if input buffer is empty
+int host_read_char(int port) {
+  char c;
+
+  if (reader_on(port)) {
+    return ring_take(port, &c, 1) ? (unsigned char) c : -1;
+  }
+  if (frame_head[port] == frame_tail[port] && fill_frame(port) == 0) {
+    return -1;
+  }
+  last_arrival[port] = frame_stamp[port];
+  return (unsigned char) frame_buffer[port][frame_tail[port]++];
+}
+
+//   H O S T _ R E A D _ B U F F E R E D
+// host_read_buffered() reads one character that the driver already
+// holds, without asking the tty for more.
+// returns -1 if nothing is buffered
+int host_read_buffered(int port) {
+  char c;
+
+  if (reader_on(port)) {
+    return ring_take(port, &c, 1) ? (unsigned char) c : -1;
+  }
+  if (frame_head[port] == frame_tail[port]) {
+    return -1;
+  }
+  last_arrival[port] = frame_stamp[port];
+  return (unsigned char) frame_buffer[port][frame_tail[port]++];
+}
+
+
+//   H O S T _ R E A D _ A V A I L A B L E
+// host_read_available() copies up to max chars that have already
+// arrived into buf without waiting.  Returns # of chars copied.
+int host_read_available(int port, char *buf, int max) {
+  int n;
+
+  if (reader_on(port)) {
+    return ring_take(port, buf, max);
+  }
+  n = frame_head[port] - frame_tail[port];
+  if (n == 0) {
+    n = fill_frame(port);
+  }
+  if (n > max) n = max;
+  if (n > 0) last_arrival[port] = frame_stamp[port];
+  memcpy(buf, frame_buffer[port] + frame_tail[port], n);
+  frame_tail[port] += n;
+  return n;
+}
+
+
+//   H O S T _ R E A D _ B Y T E S
+// host_read_bytes() will try to read a specified number of bytes
+// until the timeout period of time expires.  It returns the number
+// of bytes it actually read.
+// Sleeps in ppoll() while the tty is empty instead of spinning.
+int host_read_bytes(int port, char *buf, int count, float timeout) {
+  struct pollfd pfd;
+  struct timespec left;
+  int read = 0;
+  int n;
+
+  /* setup the timeout */
+  host_set_timeout(port, timeout);
+  host_start_timeout(port);
+
+  pfd.fd = port_ref[port];
+  pfd.events = POLLIN;
+
+  while (read < count) {
+    n = host_read_available(port, buf + read, count - read);
+    if (n > 0) {
+      read += n;
+      continue;
+    }
+    if (reader_on(port)) {
+      if (ring_wait(port) == 0) break;
+      continue;
+    }
+
+    /* Nothing pending: sleep until data arrives or the deadline passes */
+    if (pfd.fd < 0 || !time_left(port, &left)) {
+      break;
+    }
+    n = ppoll(&pfd, 1, &left, NULL);
+    if (n == 0 || (n < 0 && errno != EINTR)) {
+      break;
+    }
+    if (n > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+      break;
+    }
+  }
+
+  return read;
+}
+
+
+//   H O S T _ W R I T E _ C H A R
+// host_write_char() writes one character to the serial output buffer
+// Returns False (zero) if buffer is full
+// Returns True (non-zero) if successful
+int host_write_char(int port, int ch) {
+  char c = ch;
+
+  return (port_ref[port] >= 0 && write(port_ref[port], &c, 1) == 1);
+}
+
+
+//   H O S T _ W R I T E _ S T R I N G
+// host_write_string() writes a null-terminated string to the output buffer
+// Returns False (zero) if not able to write the whole string
+// Returns True (non-zero) if successful
+int host_write_string(int port, char *str) {
+  return host_write_bytes(port, str, strlen(str));
+}
+
+
+//   H O S T _ W R I T E _ B Y T E S
+// host_write_bytes() writes count chars from buf, a whole command at a
+// time, so that it goes out in a single write() whenever the tty accepts it.
+// Returns False (zero) if not able to write all of them
+// Returns True (non-zero) if successful
+int host_write_bytes(int port, char *buf, int count) {
+  int n;
+
+  if (port_ref[port] < 0) {
+    return 0;
+  }
+  while (count > 0) {
+    n = write(port_ref[port], buf, count);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return 0;
+    }
+    buf += n;
+    count -= n;
+  }
+  return 1;
+}
+
+/*----------------------------*/
+/* Getting Serial Port Status */
+/*----------------------------*/
+
+
+//   H O S T _ P O R T _ V A L I D
+// host_port_valid() returns True if the specified port number is valid
+int host_port_valid(int port) {
+  return (port > 0) && (port <= NUM_PORTS);
+}
+
+
+//   H O S T _ I N P U T _ C O U N T
+// host_input_count() returns the number of chars waiting in the input queue
+int host_input_count(int port) {
+  int pending = 0;
+
+  if (reader_on(port)) {
+    return ring_count(port);
+  }
+  if (port_ref[port] >= 0) {
+    ioctl(port_ref[port], FIONREAD, &pending);
+  }
+  return pending + frame_head[port] - frame_tail[port];
+}
+
+
+//   H O S T _ I N P U T _ F U L L
+// host_input_full() tells whether or not the serial input queue is full
+int host_input_full(int port) {
+  /* the n_tty line discipline holds 4096 chars */
+  return host_input_count(port) >= 4096;
+}
+
+
+/*-------------------*/
+/* Calibration Cache */
+/*-------------------*/
+
+#define CACHE_NAME_SIZE 48
+
+
+//   C A C H E _ F I L E
+// cache_file() makes the file name for a cache key: MS<key>.CAL in the
+// current directory (like MSTIP.DAT), keeping only letters and digits.
+static void cache_file(char *key, char *name, int size) {
+  int n = 0;
+
+  name[n++] = 'M';
+  name[n++] = 'S';
+  for (; *key && n < size - 9; key++) {
+    if (isalnum((unsigned char) *key)) {
+      name[n++] = *key;
+    }
+  }
+  strcpy(name + n, ".CAL");
+}
+
+
+//   H O S T _ L O A D _ C A C H E
+// host_load_cache() reads the record saved under key into buf.
+// Returns False (zero) unless there is one of exactly size bytes.
+int host_load_cache(char *key, void *buf, int size) {
+  char name[CACHE_NAME_SIZE];
+  FILE *f;
+  int ok;
+
+  cache_file(key, name, sizeof(name));
+  if ((f = fopen(name, "rb")) == NULL) {
+    return 0;
+  }
+  ok = fread(buf, 1, size, f) == (size_t) size && fgetc(f) == EOF;
+  fclose(f);
+  return ok;
+}
+
+
+//   H O S T _ S A V E _ C A C H E
+// host_save_cache() saves size bytes of buf under key, replacing any
+// record there.  The record goes to a new file that is then renamed over
+// the old one, so an interrupted save never leaves half a record.
+// Returns False (zero) if it could not be saved.
+int host_save_cache(char *key, void *buf, int size) {
+  char name[CACHE_NAME_SIZE], temp[CACHE_NAME_SIZE + 4];
+  FILE *f;
+  int ok;
+
+  cache_file(key, name, sizeof(name));
+  snprintf(temp, sizeof(temp), "%s.new", name);
+  if ((f = fopen(temp, "wb")) == NULL) {
+    return 0;
+  }
+  ok = fwrite(buf, 1, size, f) == (size_t) size;
+  ok = (fclose(f) == 0) && ok && rename(temp, name) == 0;
+  if (!ok) {
+    remove(temp);
+  }
+  return ok;
+}
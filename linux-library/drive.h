@@ -0,0 +1,79 @@
+/***************************************************
+ * - - - - - - -   IMMERSION CORP.   - - - - - - - *
+ *                                                 *
+ *        IBM PC/Compatibles software series       *
+ *                Copyright (c) 1993               *
+ ***************************************************
+ * DRIVE.H   |   SDK1-2   |   November 1995
+ *
+ * Immersion Corp. Software Developer's Kit
+ *      Definitions and prototypes for serial communications functions
+ *  	  for the Immersion Corp. MicroScribe-3D
+ *		  Not for use with the Probe or Personal Digitizer
+ *      Requires HCI firmware version MSCR1-1C or later
+ */
+
+
+/* Public constants */
+/* Floor for hci fast_timeout (sec); covers the 16 ms latency timer of
+   USB serial adapters */
+#define MIN_TIMEOUT     0.02
+
+/* this was put in for windows only */
+int host_get_id(int port);
+
+/* Linux only: choose the device file behind a port number */
+int     host_set_device(int port, char *device);
+
+/* Linux only: optional reader thread that owns a port's input */
+int     host_start_reader(int port, int priority);
+void    host_stop_reader(int port);
+
+/* Linux only: low-latency UART profile, and the settings in effect.
+   Fields the driver does not offer read as -1. */
+typedef struct {
+  int low_latency;      /* ASYNC_LOW_LATENCY set */
+  int rx_trigger;       /* UART rx FIFO trigger level, bytes */
+  int latency_timer;    /* USB serial latency timer, ms */
+  int vmin;             /* termios VMIN and VTIME */
+  int vtime;
+} host_uart_profile;
+
+int     host_set_low_latency(int port, int on);
+int     host_get_uart_profile(int port, host_uart_profile *profile);
+
+
+/* Timing functions */
+void    host_pause(float delay_sec);
+float   host_get_timeout(int port);
+void    host_set_timeout(int port, float timeout_sec);
+void    host_start_timeout(int port);
+int     host_timed_out(int port);
+unsigned long host_clock_usec(void);
+unsigned long long host_arrival_usec(int port);
+
+
+/* Configuring serial ports */
+void    host_fix_baud(long int *baud);
+int     host_open_serial(int port, long int baud);
+void    host_close_serial(int port);
+int     host_set_baud(int port, long int baud);
+void    host_flush_serial(int port);
+
+
+/* Reading/writing serial data */
+int     host_read_char(int port);
+int     host_read_buffered(int port);
+int     host_read_bytes(int port, char *buf, int count, float timeout);
+int     host_read_available(int port, char *buf, int max);
+int     host_write_char(int port, int ch);
+int     host_write_string(int port, char *str);
+int     host_write_bytes(int port, char *buf, int count);
+int     host_port_valid(int port);
+int     host_input_count(int port);
+int     host_input_full(int port);
+
+
+/* Calibration cache, see arm_use_cache() */
+int     host_load_cache(char *key, void *buf, int size);
+int     host_save_cache(char *key, void *buf, int size);
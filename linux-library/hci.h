@@ -0,0 +1,475 @@
+/***************************************************
+ * - - - - - - -   IMMERSION CORP.   - - - - - - - *
+ *                                                 *
+ *       Platform-independent software series      *
+ *                Copyright (c) 1993               *
+ ***************************************************
+ * HCI.C   |   SDK1-2a   |   January 1996
+ *
+ * Immersion Corp. Software Developer's Kit
+ *      Functions for direct communication with the Immersion HCI
+ *      Not for use with the Probe or Personal Digitizer
+ *      Requires Microscribe HCI firmware version MSCR1-1C
+ */
+
+
+#ifndef hci_h
+#define hci_h
+
+/*-----------*/
+/* Constants */
+/*-----------*/
+
+#define HCI_CHECK_FGND		1
+#define HCI_CHECK_BGND		2
+#define HCI_CHECK_MOTION	3
+
+#define NUM_ENCODERS    7       /* Max # encoders supported by Immersion HCI */
+#define NUM_ANALOGS     8       /* Max # of A/D channels supported */
+#define NUM_BUTTONS     7       /* Max # of buttons supported */
+
+/* These numbers are the maximum numbers available in Immersion HCI hardware.
+ *   Various Immersion Corp. products based on the Immersion HCI will
+ *   support various subsets of these components.
+ */
+
+
+/*------------*/
+/* Data Types */
+/*------------*/
+
+/* hci_result is an enumerated type.  Compare variables of this type to
+ *   the constants below; SUCCESS is zero.  Use hci_result_string() to
+ *   print one.  The codes also index the handler[] and result_count[]
+ *   tables of an hci_rec.
+ */
+#ifdef __WIN32__
+#ifdef TRY_AGAIN[]
+#undef TRY_AGAIN
+#endif /* TRY_AGAIN */
+#endif /* __WIN32__ */
+
+typedef enum
+{
+	SUCCESS,        /* Successful operation */
+	NO_PACKET_YET,  /* Complete packet not yet recv'd */
+	TRY_AGAIN,      /* Try the operation again */
+	TIMED_OUT,      /* Didn't get complete packet in time */
+	BAD_PORT_NUM,   /* Port number not valid */
+	BAD_PACKET,     /* Received packet that did not make sense */
+	NO_HCI,         /* No response from HCI during start-up */
+	CANT_BEGIN,     /* No response to "BEGIN" at start of session */
+	CANT_OPEN_PORT, /* Can't open the port during start-up */
+	BAD_PASSWORD,   /* Cfg cmd requiring passwd was denied */
+	BAD_VERSION,    /* Feature isn't supported by firmware */
+	BAD_FORMAT,     /* Parameter block is in unreadable format */
+	NUM_HCI_RESULTS /* # of result codes, not a result itself */
+} hci_result;
+
+/* Shorthand for a byte */
+typedef unsigned char   byte;
+
+
+/* # of bytes in longest possible packet, plus some extra room */
+#define MAX_PACKET_SIZE         42
+
+/* Max # of args to a special config command */
+#define MAX_CFG_SIZE            40
+
+/* Max length of descriptor string from HCI */
+#define MAX_STRING_SIZE         32
+
+/* Space for arguments to config commands */
+extern byte     cfg_args[MAX_CFG_SIZE];
+extern int      num_cfg_args; /* # of values stored in cfg_args[] */
+
+/* Record for packet
+ */
+typedef struct
+{
+	int     parsed;         /* Flag tells whether this packet has been parsed */
+	int     error;          /* Flag tells whether there has been com error */
+	int     num_bytes_needed;
+	byte    cmd_byte;
+	byte    data[MAX_PACKET_SIZE];
+	byte    *data_ptr;
+	byte    spare[MAX_PACKET_SIZE];   /* chars to scan again after resynch */
+	int     spare_at;
+	int     num_spare;
+	unsigned long long first_usec;  /* arrival of the cmd byte */
+	unsigned long long last_usec;   /* arrival of the last data byte */
+} packet_rec;
+
+
+/* Record for the data of one standard packet: the unit for recording,
+ *   queuing and batch processing.  Plain data of a fixed 48 bytes with no
+ *   padding, so hci_parse_sample() can write it straight into an array
+ *   or a ring buffer and it can be saved to a file as it is.
+ *   Bits in 'present' tell which fields hold data; buttons always do.
+ *   first_usec and last_usec tell when the host received the first and
+ *   last byte of the packet, on the host_arrival_usec() clock
+ *   (CLOCK_MONOTONIC on Linux), so the age of a sample is known.
+ *   hci_sample_view() copies one into the hci_rec fields.
+ */
+typedef struct
+{
+	unsigned short  present;        /* SAMPLE_ bits below */
+	unsigned short  timer;
+	unsigned short  encoder [NUM_ENCODERS];
+	byte            analog [NUM_ANALOGS];
+	byte            buttons;        /* button bits all together */
+	byte            cmd_byte;       /* cmd byte of the packet */
+	byte            reserved [4];   /* keeps the times 8-byte aligned */
+	unsigned long long first_usec;  /* arrival of the cmd byte */
+	unsigned long long last_usec;   /* arrival of the last data byte */
+} hci_sample;
+
+#define SAMPLE_ENCODER(i)   (1u << (i))         /* bits 0-6 */
+#define SAMPLE_ANALOG(i)    (0x80u << (i))      /* bits 7-14 */
+#define SAMPLE_TIMER        0x8000u
+
+
+/* # of bins in each latency histogram.  Bin i counts latencies of
+ *   2^(i-1) up to 2^i usec, bin 0 counts zero, and the last bin counts
+ *   everything longer as well. */
+#define LATENCY_BINS    24
+
+/* # of requests in flight whose send times are kept for the histograms */
+#define LATENCY_QUEUE   16
+
+/* # of times hci_get_stats() tries for a copy no update ran through */
+#define STATS_TRIES     100
+
+/* Record of link statistics, see hci_get_stats().
+ *   Counts the requests and packets that go through the packet parser
+ *   (hci_std_cmd(), hci_simple_cfg_cmd(), hci_insert_marker() and
+ *   hci_build_packet()), not the exchanges made while connecting.
+ */
+typedef struct
+{
+	unsigned long   packets_sent;   /* requests issued */
+	unsigned long   packets_received; /* complete packets */
+	unsigned long   bytes_sent;
+	unsigned long   bytes_received; /* line noise included */
+	unsigned long   timeouts;       /* TIMED_OUT passed to hci_error() */
+	unsigned long   bad_packets;    /* BAD_PACKET passed to hci_error() */
+	unsigned long   resyncs;        /* times the parser found its place again */
+	int             queue_depth;    /* packets_expected, as last seen */
+	int             max_queue_depth;
+	unsigned long   first_byte_usec [LATENCY_BINS]; /* request to cmd byte */
+	unsigned long   complete_usec [LATENCY_BINS];   /* request to whole packet */
+} hci_stats;
+
+
+/* Record containing all HCI data
+ *   Declare one of these structs for each Immersion HCI in use.
+ *   The hci_connect() command will establish communication with an Immersion
+ *      HCI and set up an hci_rec corresponding to it.
+ *   Example references: (assuming 'hci' is declared as an hci_rec)
+ *      hci.button[2] - ON/OFF status of button #2
+ *      hci.encoder[1] - total count for encoder #1
+ *      hci.baud_rate - baud rate in use with this Immersion HCI
+ */
+typedef struct hci_rec
+{
+	/* Communications parameters */
+	int             port_num;       /* This HCI's serial port number */
+	long int        baud_rate;      /* This Probe's baud rate */
+	float           slow_timeout;   /* Timeout period for slow process */
+	float           fast_timeout;   /* Timeout period for fast process */
+	packet_rec      packet;         /* The current packet */
+	int             packets_expected; /* Determines whether timeout is important */
+	long int        bytes_dropped;  /* Line noise skipped by the packet parser */
+	long int        packets_dropped;  /* Corrupted packets it threw away */
+	long int        signon_baud;    /* Rate the Arm was found at by autosynch */
+	unsigned long   signon_usec;    /* Time the last autosynch took */
+
+	/* Marker field lets you mark different segments of data in incoming
+	 *   buffer.  hci_insert_marker() makes HCI insert a marker into the
+	 *   data stream, so you can switch modes in a host application
+	 *   without misinterpreting some data that may still be waiting
+	 *   in the buffer; just insert a marker, and don't switch modes
+	 *   until you see the marker come back.
+	 */
+	int             marker;
+	int             marker_updated;
+
+	/* Primary quantities: */
+	int     buttons;                /* button bits all together */
+	int     button [NUM_BUTTONS];   /* ON/OFF flags for buttons */
+	long    timer;                  /* Running counter */
+	int     analog [NUM_ANALOGS];   /* A/D channels */
+	int     encoder [NUM_ENCODERS]; /* Encoder counts */
+
+	/* Arrival of the first and last byte of the packet the fields above
+	 *   came from, as in hci_sample */
+	unsigned long long first_usec;
+	unsigned long long last_usec;
+
+	/* Normalization values for primary quantities:
+	 *   These values give some reference or normalization quantity
+	 *     for each field.
+	 *   A zero in any of these fields means there is no hardware
+	 *     support for that data in this particular system.
+	 */
+	int     button_supported [NUM_BUTTONS]; /* zero = button not supported */
+	int     max_timer;                      /* Max count reached before wrapping */
+	int     max_analog [NUM_ANALOGS];       /* Full-scale A/D reading */
+	int     max_encoder [NUM_ENCODERS];     /* Max value each encoder reaches
+					 * INCLUDING quadrature */
+
+	/* Status of primary fields:
+	 *   A zero in any of these fields indicates that the corresponding
+	 *     primary quantity is out of date (wasn't updated by the
+	 *     previous packets)
+	 *   Note: buttons are updated with every packet
+	 */
+	int     timer_updated;
+	int     analog_updated [NUM_ANALOGS];
+	int     encoder_updated [NUM_ENCODERS];
+
+	/* Encoder "home" position:
+	 *   The relative encoders supported by the Immersion HCI only report
+	 *   their NET angular motion from the time they are powered up.  If
+	 *   an encoder's initial angular value is important, it must somehow
+	 *   be assumed or calibrated at start-up.  These fields contain values
+	 *   to be assumed at start-up.  They can be read from or written to the
+	 *   Immersion HCI EEPROM.  If written to the Immersion HCI EEPROM,
+	 *   these "home" values will be retained even after power is turned off.
+	 */
+	int     home_pos [NUM_ENCODERS];
+
+	/* Home position references:
+	 *   In many cases some calibration procedure will be required to ensure
+	 *   that the encoder positions truly match the assumed home position.
+	 *   This array can store any data that is useful for that purpose.
+	 */
+	 int    home_ref [NUM_ENCODERS];
+
+	/* Descriptor strings:
+	 *   These strings provide information about a particular HCI system.
+	 */
+	char    serial_number [MAX_STRING_SIZE];
+	char    product_name [MAX_STRING_SIZE];
+	char    product_id [MAX_STRING_SIZE];
+	char    model_name [MAX_STRING_SIZE];
+	char    comment [MAX_STRING_SIZE];
+	char    param_format [MAX_STRING_SIZE];
+	char    version [MAX_STRING_SIZE];
+
+	/* Function pointers to handle application-specific functions
+	 *   These pointers are initialized to NULL.
+	 *   The user can make these point to handlers for each specific condition.
+	 *   These handlers must be declared as follows:
+	 *      hci_result   my_handler(hci_rec *hci, hci_result condition);
+	 * See programmer's guide for more discussion.
+	 */
+
+	/* Handlers for errors, indexed by condition,
+	 *   e.g. hci.handler[TIMED_OUT] = my_handler;
+	 *   The SUCCESS and NO_PACKET_YET entries are never used. */
+	hci_result      (*handler[NUM_HCI_RESULTS])(struct hci_rec *hci, hci_result condition);
+
+	/* Handler to use for an error if everything above is NULL
+	 * The simplest way to get diagnostic reporting is to
+	 * set default_handler to a function that outputs the string
+	 * that is passed as the 'condition'.  This can be implemented
+	 * under any operating system or window environment by including
+	 * the appropriate o.s. calls in the function pointed to by
+	 * this handler pointer.
+	 */
+	hci_result      (*default_handler)(struct hci_rec *hci, hci_result condition);
+
+	/* Number of times each condition has gone through hci_error(),
+	 *   indexed by condition */
+	long int        result_count[NUM_HCI_RESULTS];
+
+	/* Link statistics: read them with hci_get_stats(), which may be
+	 *   called from another thread.  stats_seq is odd while they change.
+	 *   The send times of requests in flight are kept in sent_usec[]
+	 *   until their packets arrive.
+	 */
+	hci_stats       stats;
+	unsigned        stats_seq;
+	unsigned long   sent_usec [LATENCY_QUEUE];
+	unsigned long   num_sent;       /* requests timed so far */
+	unsigned long   num_answered;   /* of those, how many have been answered */
+	unsigned long   answer_usec;    /* send time of the packet being built */
+	int             answer_timed;   /* answer_usec is valid */
+	long int        stats_dropped;  /* bytes_dropped already in stats */
+
+	/* Extra field available for user's application-specific purpose */
+	long int        user_data;
+} hci_rec;
+
+
+
+/* Macro for creating a command byte from a timer flag and the # of analog
+ *  and encoder reports desired
+ */
+#define CMD_BYTE(t, anlg, encd) \
+	(   (t ? TIMER_BIT : 0)                         \
+		| (anlg > 4 ? ANALOG_BITS :             \
+		    (anlg > 2 ? ANALOG_HI_BIT :         \
+		    (anlg ? ANALOG_LO_BIT : 0)))        \
+		| (encd > 6 ? ENCODER_HI_BIT :            \
+		    (encd > 5 ? ENCODER_BITS :        \
+		    (encd ? ENCODER_LO_BIT : 0)))   )
+
+
+/*---------------------*/
+/* Low-level Constants */
+/*---------------------*/
+
+/* Labels for the Special Configuration Commands */
+#define CONFIG_MIN      0xC0    /* Minimum cmd byte for a config cmd */
+#define GET_PARAMS      0xC0
+#define GET_HOME_REF    0xC1
+#define HOME_POS        0xC2
+#define SET_HOME        0xC3
+#define SET_BAUD        0xC4
+#define END_SESSION     0xC5
+#define GET_MAXES       0xC6
+#define SET_PARAMS      0xC7
+#define GET_PROD_NAME   0xC8
+#define GET_PROD_ID     0xC9
+#define GET_MODEL_NAME  0xCA
+#define GET_SERNUM      0xCB
+#define GET_COMMENT     0xCC
+#define GET_PRM_FORMAT  0xCD
+#define GET_VERSION     0xCE
+#define REPORT_MOTION   0xCF
+#define SET_HOME_REF    0xD0
+#define RESTORE_FACTORY 0xD1
+#define INSERT_MARKER   0xD2
+#define GET_EXT_PARAMS	0xD3
+
+/* Command bit-field place values */
+#define PACKET_MARKER   0x80
+#define CONFIG_BIT      0x40
+#define TIMER_BIT       0x20
+#define FUTURE_BIT      0x10
+#define ANALOG_BITS     0x0C
+#define ANALOG_HI_BIT   0x08
+#define ANALOG_LO_BIT   0x04
+#define ENCODER_BITS    0x03
+#define ENCODER_HI_BIT  0x02
+#define ENCODER_LO_BIT  0x01
+
+/* A timeout period is the time to transmit this many chars */
+#define TIMEOUT_CHARS   2*MAX_PACKET_SIZE
+
+/* Time (sec) allowed for the Arm to start echoing a signon attempt,
+ *   on top of the time to send it and read the echo */
+#define SIGNON_WAIT     5e-3
+
+/* Chars sent and echoed in a signon attempt: END_SESSION, then SIGNON_STR */
+#define SIGNON_CHARS    9
+
+/* Most chars to scan for the echo before making another signon attempt */
+#define SIGNON_SCAN     64
+
+/* Time (sec) to wait after ending session */
+#define END_PAUSE       15e-3
+
+/* Time (sec) to wait for each byte arg to a passwd-protected cfg cmd */
+#define CFG_ARG_PAUSE   15e-3
+
+/* Time (sec) to wait after restoring factory settings */
+#define RESTORE_PAUSE   2.0
+
+/* Rate every HCI and cable can sign on at */
+#define SAFE_BAUD       9600L
+
+/* # of test packets that must arrive intact before a baud rate is kept */
+#define UPGRADE_BURST   32
+
+/* # of test requests in flight during hci_verify_link() */
+#define VERIFY_DEPTH    4
+
+/* Code sent by HCI to accept a password */
+#define PASSWD_OK       0xFF
+
+
+
+/*---------------------*/
+/* Function Prototypes */
+/*---------------------*/
+
+/* Initialize and setup an hci_rec */
+void            hci_init(hci_rec *hci, int port, long int baud);
+hci_result      hci_connect(hci_rec *hci);
+void            hci_disconnect(hci_rec *hci);
+hci_result      hci_get_strings(hci_rec *hci);
+hci_result      hci_get_constants(hci_rec *hci, byte *block, int *block_size);
+void            hci_change_baud(hci_rec *hci, long int new_baud);
+hci_result      hci_verify_link(hci_rec *hci, int burst);
+hci_result      hci_upgrade_baud(hci_rec *hci, long int max_baud, int burst);
+void            hci_reset_com(hci_rec *hci);
+hci_result      hci_autosynch(hci_rec *hci);
+hci_result      hci_begin(hci_rec *hci);
+void            hci_end(hci_rec *hci);
+void            hci_clear_packet(hci_rec *hci);
+void            hci_com_params(hci_rec *hci, int port, long int baud);
+void            hci_fast_timeout(hci_rec *hci);
+void            hci_slow_timeout(hci_rec *hci);
+
+/* Issuing commands to HCI */
+void            hci_std_cmd(hci_rec *hci, int timer_flag, int analog_reports,
+				int encoder_reports);
+void            hci_simple_cfg_cmd(hci_rec *hci, byte cmnd);
+hci_result      hci_string_cmd(hci_rec *hci, byte cmnd);
+hci_result      hci_passwd_cmd(hci_rec *hci, byte cmnd);
+void            hci_insert_marker(hci_rec *hci, byte marker);
+hci_result      hci_get_params(hci_rec *hci, byte *block, int *block_size);
+hci_result      hci_get_ext_params(hci_rec *hci, byte *block, int *block_size);
+hci_result      hci_set_params(hci_rec *hci, byte *block, int block_size);
+hci_result      hci_get_home_ref(hci_rec *hci);
+hci_result      hci_set_home_ref(hci_rec *hci, int *homeref);
+hci_result      hci_go_home_pos(hci_rec *hci);
+hci_result      hci_set_home_pos(hci_rec *hci, int *homepos);
+hci_result      hci_get_maxes(hci_rec *hci);
+hci_result      hci_factory_settings(hci_rec *hci);
+void            hci_report_motion(hci_rec *hci, int timer_flag,
+		int analog_reports, int encoder_reports, int delay,
+		byte active_btns, int *analog_deltas, int *encoder_deltas);
+void            hci_end_motion(hci_rec *hci);
+
+/* Compatibility Checking */
+float   hci_version_num(hci_rec *hci);
+
+/* Packet monitoring functions */
+hci_result      hci_wait_packet(hci_rec *hci);
+hci_result      hci_check_packet(hci_rec *hci,int checkType);
+hci_result      hci_check_motion(hci_rec *hci);
+int             hci_read_motion(hci_rec *hci, hci_sample *samples, int max);
+hci_result      hci_build_packet(hci_rec *hci,int checkTYpe);
+
+/* Packet parsing functions */
+hci_result      hci_parse_packet(hci_rec *hci);
+hci_result      hci_parse_cfg_packet(hci_rec *hci);
+hci_result      hci_parse_sample(hci_rec *hci, hci_sample *sample);
+void            hci_sample_view(hci_rec *hci, hci_sample *sample);
+int             hci_packet_size(int cmd);
+
+/* Helper functions */
+hci_result      hci_read_string(hci_rec *hci, char *str);
+hci_result      hci_read_block(hci_rec *hci, byte *block, int *bytes_read);
+void            hci_invalidate_fields(hci_rec *hci);
+void            hci_strcopy(char *from, char *to);
+int             hci_strcmp(char *s1, char *s2);
+
+/* Error handling */
+hci_result      hci_error(hci_rec *hci, hci_result condition);
+hci_result      hci_simple_string(hci_rec *hci, hci_result condition);
+const char     *hci_result_string(hci_result result);
+
+/* Link statistics */
+int             hci_get_stats(hci_rec *hci, hci_stats *stats);
+void            hci_clear_stats(hci_rec *hci);
+
+/* Conversion between baud rates and 6811 BAUD register codes */
+byte            baud_to_code(long int baud);
+long int        code_to_baud(byte code);
+
+#endif /* hci_h */
\ No newline at end of file
@@ -0,0 +1,345 @@
+/*
+  M I C R O S C R I B E   -   K I N E M A T I C S   T E S T
+
+  Mårten Nettelbladt / PEGGY INSTRUMENTS
+  2026-10-17
+
+  Checks the closed-form arm_calc_T() and arm_calc_M() against the
+  original chain of 4x4 link matrices, and the incremental update of
+  arm_calc_stylus_6DOF() against a full recompute, then times them.
+  Needs no Arm.
+
+  Build: gcc -O2 -o kinematics_test kinematics_test.c arm.c hci.c drive.c -lm -lpthread
+  Exits non-zero if a check fails.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "hci.h"
+#include "arm.h"
+
+
+#define NUM_POSES       100000
+#define NUM_UPDATES     200000
+#define NUM_TIMED       200000
+#define NUM_RUNS        20
+#define MAX_REL_ERROR   1e-5    /* float rounding, relative to the link lengths */
+#define LENGTH_SCALE    300.0   /* largest A & D drawn, in mm */
+
+static matrix_4 ref_M[NUM_DOF];
+static matrix_4 ref_T;
+static length_3D ref_endpoint[NUM_DOF];
+
+
+/* rnd() returns a random number in [-1, 1]
+ */
+static double rnd(void)
+{
+	return rand() / (double) RAND_MAX * 2.0 - 1.0;
+}
+
+
+/* now() reads the monotonic clock in seconds
+ */
+static double now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+/* ref_calc_M() builds the link matrices the way arm_calc_M() used to,
+ *   with BETA's sine & cosine taken for every call.
+ */
+static void ref_calc_M(arm_rec *arm)
+{
+	int i;
+	ratio   c, s, ca, sa, cb, sb;
+	matrix_4 *M;
+
+	for(i=0;i<NUM_DOF;i++)
+	{
+		c = arm->cs[i], s = arm->sn[i];
+		ca = arm->csALPHA[i], sa = arm->snALPHA[i];
+		M = &ref_M[i];
+		if (i != 2) {
+			(*M)[0][0] = c, (*M)[0][1] = -s;
+			(*M)[0][2] = 0.0, (*M)[0][3] = arm->A[i];
+			(*M)[1][0] = s*ca, (*M)[1][1] = c*ca;
+			(*M)[1][2] = -sa, (*M)[1][3] = -sa*arm->D[i];
+			(*M)[2][0] = s*sa, (*M)[2][1] = c*sa;
+			(*M)[2][2] = ca, (*M)[2][3] = ca*arm->D[i];
+		} else {
+			cb = cos(arm->BETA), sb = sin(arm->BETA);
+			(*M)[0][0] = c*cb, (*M)[0][1] = -s*cb;
+			(*M)[0][2] = sb, (*M)[0][3] = sb*arm->D[i]+arm->A[i];
+			(*M)[1][0] = s*ca+sa*sb*c, (*M)[1][1] = c*ca-sa*sb*s;
+			(*M)[1][2] = -sa*cb, (*M)[1][3] = -sa*cb*arm->D[i];
+			(*M)[2][0] = s*sa-ca*sb*c, (*M)[2][1] = c*sa+s*sb*ca;
+			(*M)[2][2] = ca*cb, (*M)[2][3] = cb*ca*arm->D[i];
+		}
+		(*M)[3][0] = (*M)[3][1] = (*M)[3][2] = 0.0;
+		(*M)[3][3] = 1.0;
+	}
+}
+
+
+/* ref_calc_T() multiplies out the link matrices the way arm_calc_T()
+ *   used to, storing the endpoints along the way.
+ */
+static void ref_calc_T(void)
+{
+	int i;
+	matrix_4 temp;
+
+	arm_assign_4x4(temp, ref_M[0]);
+	for(i=0;i<NUM_DOF;i++)
+	{
+		if (i > 0)
+		{
+			arm_mul_4x4(temp, ref_M[i], ref_T);
+			arm_assign_4x4(temp, ref_T);
+		}
+		ref_endpoint[i].x = temp[0][3];
+		ref_endpoint[i].y = temp[1][3];
+		ref_endpoint[i].z = temp[2][3];
+	}
+}
+
+
+/* rel_error() compares two matrix entries, the translation column
+ *   relative to the link lengths.
+ */
+static double rel_error(float a, float b, int col)
+{
+	return fabs(a - b) / (col == 3 ? LENGTH_SCALE : 1.0);
+}
+
+
+/* random_links() draws random DH parameters, with or without BETA.
+ */
+static void random_links(arm_rec *arm, int with_beta)
+{
+	int i;
+
+	for(i=0;i<NUM_DOF;i++)
+	{
+		arm->ALPHA[i] = rnd() * 3.0;
+		arm->A[i] = rnd() * LENGTH_SCALE;
+		arm->D[i] = rnd() * LENGTH_SCALE;
+	}
+	arm->BETA = with_beta ? 0.02 : 0.0;
+	arm_calc_params(arm);
+}
+
+
+/* check_closed_form() compares T, the endpoints and M[] with the
+ *   reference chain for random poses.  Returns the largest error.
+ */
+static double check_closed_form(arm_rec *arm)
+{
+	int i, k, r, c, with_beta;
+	double t, e, worst = 0.0;
+
+	for(with_beta=0;with_beta<2;with_beta++)
+	{
+		random_links(arm, with_beta);
+		for(k=0;k<NUM_POSES;k++)
+		{
+			for(i=0;i<NUM_DOF;i++)
+			{
+				t = rnd() * PI;
+				arm->cs[i] = cos(t), arm->sn[i] = sin(t);
+			}
+			arm_recalc_all(arm);    /* cs & sn were set by hand */
+			arm_calc_T(arm);
+			arm_calc_M(arm);
+			ref_calc_M(arm);
+			ref_calc_T();
+			for(r=0;r<3;r++)
+				for(c=0;c<4;c++)
+				{
+					e = rel_error(arm->T[r][c], ref_T[r][c], c);
+					if (e > worst) worst = e;
+					for(i=0;i<NUM_DOF;i++)
+					{
+						e = rel_error(arm->M[i][r][c], ref_M[i][r][c], c);
+						if (e > worst) worst = e;
+					}
+				}
+			for(i=0;i<NUM_DOF;i++)
+			{
+				e = (fabs(arm->endpoint[i].x - ref_endpoint[i].x)
+					+ fabs(arm->endpoint[i].y - ref_endpoint[i].y)
+					+ fabs(arm->endpoint[i].z - ref_endpoint[i].z))
+					/ LENGTH_SCALE;
+				if (e > worst) worst = e;
+			}
+		}
+	}
+	return worst;
+}
+
+
+/* fake_arm() sets up an arm_rec as if a 14-bit 6DOF Arm had signed on.
+ */
+static void fake_arm(arm_rec *arm)
+{
+	int i;
+
+	arm_init(arm);
+	for(i=0;i<NUM_DOF;i++)
+	{
+		arm->ALPHA[i] = i * 0.5 - 1.0;
+		arm->A[i] = i * 20.0;
+		arm->D[i] = 100.0 - i * 10.0;
+		arm->hci.max_encoder[i] = 16383;
+		arm->JOINT_RADIANS_FACTOR[i] = 2.0 * PI / 16384.0;
+		arm->JOINT_DEGREES_FACTOR[i] = 360.0 / 16384.0;
+		arm->hci.encoder[i] = rand() & 16383;
+	}
+	arm->BETA = 0.01;
+	arm_calc_params(arm);
+	arm->hci.encoder_updated[2] = arm->hci.encoder_updated[5] = 1;
+}
+
+
+/* check_incremental() moves random joints of one Arm by a few counts
+ *   at a time and compares what arm_calc_stylus_6DOF() finds with a
+ *   second Arm that recomputes every joint.  Returns # of mismatches.
+ */
+static int check_incremental(arm_rec *a, arm_rec *b, trig_table *tables, int num_tables)
+{
+	int i, k, mismatches = 0;
+
+	srand(1);
+	fake_arm(a);
+	srand(1);
+	fake_arm(b);
+	if (tables != NULL)
+	{
+		memset(tables, 0, num_tables * sizeof(trig_table));
+		arm_use_trig_tables(a, tables, num_tables);
+		arm_use_trig_tables(b, tables, num_tables);
+		arm_calc_trig_tables(a);
+		arm_calc_trig_tables(b);
+	}
+	for(k=0;k<NUM_UPDATES;k++)
+	{
+		for(i=0;i<NUM_DOF;i++)
+			if (rand() % 3 == 0)
+				a->hci.encoder[i] = (a->hci.encoder[i] + rand() % 5 - 2) & 16383;
+		memcpy(b->hci.encoder, a->hci.encoder, sizeof(a->hci.encoder));
+
+		arm_calc_joints(a);
+		arm_calc_stylus_6DOF(a);
+		arm_calc_joints(b);
+		arm_recalc_all(b);
+		arm_calc_stylus_6DOF(b);
+
+		if (memcmp(a->T, b->T, sizeof(a->T))
+			|| memcmp(a->endpoint, b->endpoint, sizeof(a->endpoint)))
+			mismatches++;
+	}
+	return mismatches;
+}
+
+
+/* time_update() times one 6DOF update, with only the roll joint moving
+ *   (roll_only) or with every joint moving.  Returns nsec per update.
+ */
+static double time_update(arm_rec *arm, int roll_only)
+{
+	int i, k, run;
+	double start, took, best = 1e9;
+
+	srand(2);
+	fake_arm(arm);
+	for(run=0;run<NUM_RUNS;run++)
+	{
+		start = now();
+		for(k=0;k<NUM_TIMED;k++)
+		{
+			for(i=roll_only?NUM_DOF-1:0;i<NUM_DOF;i++)
+				arm->hci.encoder[i] = (k + i) & 16383;
+			arm_calc_joints(arm);
+			arm_calc_stylus_6DOF(arm);
+		}
+		took = now() - start;
+		if (took < best) best = took;
+	}
+	return best / NUM_TIMED * 1e9;
+}
+
+
+/* time_chain() times the reference chain and arm_calc_T() for the same
+ *   pose.  Returns nsec per call of each.
+ */
+static void time_chain(arm_rec *arm, double *ref_nsec, double *new_nsec)
+{
+	int i, k, run;
+	double start, took;
+
+	fake_arm(arm);
+	for(i=0;i<NUM_DOF;i++)
+		arm->cs[i] = cos(i), arm->sn[i] = sin(i);
+	*ref_nsec = *new_nsec = 1e9;
+	for(run=0;run<NUM_RUNS;run++)
+	{
+		start = now();
+		for(k=0;k<NUM_TIMED;k++)
+		{
+			ref_calc_M(arm);
+			ref_calc_T();
+		}
+		took = now() - start;
+		if (took < *ref_nsec) *ref_nsec = took;
+		start = now();
+		for(k=0;k<NUM_TIMED;k++)
+		{
+			arm_recalc_all(arm);
+			arm_calc_T(arm);
+		}
+		took = now() - start;
+		if (took < *new_nsec) *new_nsec = took;
+	}
+	*ref_nsec *= 1e9 / NUM_TIMED;
+	*new_nsec *= 1e9 / NUM_TIMED;
+}
+
+
+static arm_rec arm, other;
+static trig_table tables[2];
+
+int main(void)
+{
+	double error, ref_nsec, new_nsec;
+	int sincos_bad, table_bad;
+
+	arm_init(&arm);
+	error = check_closed_form(&arm);
+	printf("Closed form vs 4x4 chain: largest relative error %g\n", error);
+
+	sincos_bad = check_incremental(&arm, &other, NULL, 0);
+	table_bad = check_incremental(&arm, &other, tables, 2);
+	printf("Incremental vs full recompute: %d mismatches with sin() & cos(),"
+		" %d with trig tables\n", sincos_bad, table_bad);
+
+	time_chain(&arm, &ref_nsec, &new_nsec);
+	printf("T: 4x4 chain %.1f ns, closed form %.1f ns\n", ref_nsec, new_nsec);
+	printf("6DOF update: roll only %.1f ns, all joints %.1f ns\n",
+		time_update(&arm, 1), time_update(&arm, 0));
+
+	if (error > MAX_REL_ERROR || sincos_bad || table_bad)
+	{
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
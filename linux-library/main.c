@@ -0,0 +1,68 @@
+/*
+  M I C R O S C R I B E   -   L I N U X   S E T U P
+
+  Mårten Nettelbladt / PEGGY INSTRUMENTS
+  2026-10-17
+
+  This is a basic example printing the x, y, and z coordinates of the arm tip
+  and the joint angles, from an arm connected to a plain Linux serial port.
+
+  Usage: microscribe [device] [baud]
+  e.g.   microscribe /dev/ttyUSB0 115200
+
+ H A R D W A R E
+ The Microscribe talks RS-232, so any RS-232 port or USB/RS-232 adapter works
+ directly. On a TTL UART (e.g. Raspberry Pi) use a Max3232 as for Bela.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hci.h"		// Microscribe fundamentals
+#include "arm.h"		// Arm specific functions
+#include "drive.h"		// Platfom specific functions
+
+
+long baud = 115200L;
+int port = 1;
+
+arm_rec arm;
+host_uart_profile uart;
+
+int main(int argc, char *argv[])
+{
+	arm_result result;
+
+	if (argc > 1) host_set_device(port, argv[1]);
+	if (argc > 2) baud = atol(argv[2]);
+
+	arm_init(&arm);
+	arm_install_simple(&arm);
+	host_set_low_latency(port, 1);
+	arm_use_cache(&arm);
+
+	result = arm_connect(&arm, port, baud);
+	printf("Result: %s\n", hci_result_string(result));
+	if (result != SUCCESS) return 1;
+
+	printf("%s %s, %s\n", arm.hci.product_name, arm.hci.model_name,
+		arm.hci.serial_number);
+	printf("Sign-on: %lu us, arm found at %ld baud\n", arm.hci.signon_usec,
+		arm.hci.signon_baud);
+	if (host_get_uart_profile(port, &uart))
+		printf("UART: low latency %d, rx trigger %d, latency timer %d, VMIN %d, VTIME %d\n",
+			uart.low_latency, uart.rx_trigger, uart.latency_timer, uart.vmin, uart.vtime);
+
+	while (1)
+	{
+		result = arm_stylus_6DOF_update(&arm);
+		if (result != SUCCESS) continue;
+
+		printf("tip %8.2f %8.2f %8.2f   joints %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f\n",
+			arm.stylus_tip.x, arm.stylus_tip.y, arm.stylus_tip.z,
+			arm.joint_deg[0], arm.joint_deg[1], arm.joint_deg[2],
+			arm.joint_deg[3], arm.joint_deg[4], arm.joint_deg[5]);
+	}
+
+	arm_disconnect(&arm);
+	return 0;
+}
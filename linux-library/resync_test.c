@@ -0,0 +1,180 @@
+/*
+  M I C R O S C R I B E   -   R E S Y N C   T E S T
+
+  Mårten Nettelbladt / PEGGY INSTRUMENTS
+  2026-10-17
+
+  Checks the spare buffer hci_build_packet() resynchronizes from, that
+  it skips noise that looks like a config cmd, and that
+  hci_get_constants() refuses a param block too long for the room it
+  was given.  Includes hci.c
+  itself to reach its static helpers.  Needs no Arm: a pseudo-terminal
+  stands in for the serial line.
+
+  Build: gcc -O2 -o resync_test resync_test.c drive.c -lm -lpthread
+  Exits non-zero if a check fails.
+*/
+#define _GNU_SOURCE            /* posix_openpt() and friends */
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hci.c"
+
+
+static int failed = 0;
+
+
+/* check() reports one check and remembers if it failed
+ */
+static void check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+	if (!ok) failed = 1;
+}
+
+
+/* spare_is() compares what take_spare() hands out with the expected chars
+ */
+static int spare_is(packet_rec *pk, const byte *want, int count)
+{
+	byte got[MAX_PACKET_SIZE];
+
+	return pk->num_spare == count
+		&& take_spare(pk, got, MAX_PACKET_SIZE) == count
+		&& memcmp(got, want, count) == 0;
+}
+
+
+/* check_keep_spare() sets chars aside while some are still left over,
+ *   both with fewer and with more new chars than have been taken.
+ */
+static void check_keep_spare(void)
+{
+	static packet_rec pk;
+	byte first[11] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	byte want[12] = { 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31 };
+	byte got[MAX_PACKET_SIZE];
+	int i;
+
+		/* 3 taken, 8 left over, 1 kept ahead of them */
+	keep_spare(&pk, first, 11);
+	take_spare(&pk, got, 3);
+	keep_spare(&pk, (byte *) "\x63", 1);
+	want[0] = 0x63;
+	for (i = 0; i < 8; i++) want[1 + i] = first[3 + i];
+	check(spare_is(&pk, want, 9), "keep_spare() with fewer new chars than taken");
+
+		/* 2 taken, 9 left over, 3 kept ahead of them */
+	keep_spare(&pk, first, 11);
+	take_spare(&pk, got, 2);
+	keep_spare(&pk, (byte *) "\x61\x62\x63", 3);
+	want[0] = 0x61, want[1] = 0x62, want[2] = 0x63;
+	for (i = 0; i < 9; i++) want[3 + i] = first[2 + i];
+	check(spare_is(&pk, want, 12), "keep_spare() with more new chars than taken");
+}
+
+
+/* check_config_noise() sends a config cmd byte the standard parser
+ *   cannot deal with, and then a standard packet.  The byte must be
+ *   counted as noise and the packet must still come through.
+ */
+static void check_config_noise(void)
+{
+	static hci_rec hci;
+	char line[2 + MAX_PACKET_SIZE];
+	int pty, size, ok;
+	hci_result result;
+
+	pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0
+		|| !host_set_device(1, ptsname(pty)))
+	{
+		check(0, "opening a pseudo-terminal");
+		return;
+	}
+	hci_init(&hci, 1, 9600);
+	host_open_serial(1, 9600);
+
+	size = hci_packet_size(PACKET_MARKER);
+	memset(line, 0, sizeof(line));
+	line[0] = (char) GET_PARAMS;
+	line[1] = (char) PACKET_MARKER;
+	ok = write(pty, line, 2 + size) == 2 + size;
+	host_pause(1e-2);
+
+	result = hci_build_packet(&hci, HCI_CHECK_BGND);
+	check(ok && result == SUCCESS && hci.packet.cmd_byte == PACKET_MARKER
+		&& hci.bytes_dropped == 1 && hci.packets_dropped == 0,
+		"a config cmd byte is skipped as noise");
+
+	host_close_serial(1);
+	close(pty);
+}
+
+
+/* check_long_params() answers hci_get_constants() with a GET_PARAMS
+ *   length byte of 41 when only 40 bytes of room were given.  It must
+ *   be a BAD_PACKET, and none of the block may be stored.
+ */
+static void check_long_params(void)
+{
+	static const byte strings[] = { GET_PROD_NAME, GET_PROD_ID,
+		GET_MODEL_NAME, GET_SERNUM, GET_COMMENT, GET_PRM_FORMAT, GET_VERSION };
+	static hci_rec hci;
+	char line[2 + MAX_PACKET_SIZE + 2];
+	byte block[2 * 40];
+	int pty, i, size, ok = 1;
+	hci_result result;
+
+	pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0
+		|| !host_set_device(1, ptsname(pty)))
+	{
+		check(0, "opening a pseudo-terminal");
+		return;
+	}
+	hci_init(&hci, 1, 9600);
+	host_open_serial(1, 9600);
+
+	for (i = 0; i < (int) sizeof(strings); i++)
+	{
+		line[0] = (char) strings[i], line[1] = 'x', line[2] = 0;
+		ok = ok && write(pty, line, 3) == 3;
+	}
+	size = hci_packet_size(GET_MAXES);
+	memset(line, 0, sizeof(line));
+	line[0] = (char) GET_MAXES;
+	line[1 + size] = (char) GET_PARAMS;
+	line[2 + size] = 41;
+	ok = ok && write(pty, line, 3 + size) == 3 + size;
+	memset(block, 0xAA, sizeof(block));
+	ok = ok && write(pty, block, 41) == 41;
+	memset(block, 0, sizeof(block));
+	host_pause(1e-2);
+
+	size = 40;
+	result = hci_get_constants(&hci, block, &size);
+	for (i = 0; i < (int) sizeof(block); i++)
+		if (block[i] != 0) ok = 0;
+	check(ok && result == BAD_PACKET, "a param block longer than its room is refused");
+
+	host_close_serial(1);
+	close(pty);
+}
+
+
+int main(void)
+{
+	check_keep_spare();
+	check_config_noise();
+	check_long_params();
+
+	if (failed)
+	{
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}